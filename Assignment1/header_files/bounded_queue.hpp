@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "common.hpp"
+
+using namespace std;
+
+// A queue of bounded capacity between a producer thread and a consumer coroutine.
+// push() blocks the producer while the queue is full, which gives backpressure from the
+// consumer, and pop() suspends the consumer coroutine while the queue is empty.
+template <typename T>
+class bounded_queue {
+public:
+    bounded_queue(boost::asio::any_io_executor executor, size_t capacity)
+        : executor(executor), capacity(capacity), not_empty(executor) {}
+
+    // Called from the producer thread. Returns false if the queue has been closed.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&] { return items.size() < capacity || closed; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        lock.unlock();
+
+        // The condition may only be touched from the thread running the io_context
+        boost::asio::post(executor, [this] { not_empty.notify_all(); });
+        return true;
+    }
+
+    // Called from a coroutine running on the io_context
+    awaitable<T> pop() {
+        while (true) {
+            std::optional<T> item;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!items.empty()) {
+                    item = std::move(items.front());
+                    items.pop_front();
+                }
+            }
+            if (item) {
+                not_full.notify_one();
+                co_return std::move(*item);
+            }
+            co_await not_empty.wait();
+        }
+    }
+
+    // Wake up and reject a blocked producer, e.g. once the consumers have stopped
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        not_full.notify_all();
+    }
+
+private:
+    boost::asio::any_io_executor executor;
+    size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    async_condition not_empty;
+    bool closed = false;
+};
@@ -8,6 +8,9 @@
 #include <bits/stdc++.h>
 #include <vector>
 
+#include "ring.hpp"
+#include "../../common/prg.hpp"
+
 using namespace std;
 using boost::asio::awaitable;
 using boost::asio::co_spawn;
@@ -18,13 +21,34 @@ namespace this_coro = boost::asio::this_coro;
 
 
 /*------------- CONSTANTS ---------------*/
-int no_of_features = 3;
-int no_of_users = 3;
-int no_of_items = 3;
+// Dimensions of U (m x k) and V (n x k). P2 takes them from the input file or the command line,
+// P0 and P1 from the shapes of the shares they receive.
+int no_of_features = 0;
+int no_of_users = 0;
+int no_of_items = 0;
 
-int64_t PRIME = 69696969; // random numbers will be between 0 and PRIME
+int64_t MAX_QUERIES_IN_FLIGHT = 64; // queries that P0/P1 process concurrently
+int64_t DEALER_QUEUE_CAPACITY = 4; // queries whose correlations P2 buffers ahead of the sockets
 /*****************************************/
 
+// How P2 delivers the correlated randomness of each query to P0 and P1
+enum preprocessing_mode : int64_t {
+    PREPROCESSING_FULL = 0,   // every mask is sent explicitly
+    PREPROCESSING_SEEDED = 1, // the parties expand their masks from a PRG seed, only corrections are sent
+};
+
+// How P2 delivers the shares of the standard basis vector e_j of each query
+enum item_selection_mode : int64_t {
+    ITEM_SELECTION_DENSE = 0, // length n shares of e_j
+    ITEM_SELECTION_DPF = 1,   // O(log n) DPF keys that the parties expand to shares of e_j
+};
+
+// The modes P2 runs the protocol in, announced to P0 and P1 before the first query
+struct protocol_modes {
+    preprocessing_mode preprocessing = PREPROCESSING_FULL;
+    item_selection_mode item_selection = ITEM_SELECTION_DENSE;
+};
+
 vector<vector<int64_t>> TEST_U = {
     {1, 2, 3},
     {4, 5, 6},
@@ -38,6 +62,27 @@ vector<vector<int64_t>> TEST_V = {
 };
 
 // ----------------------- Helper coroutines -----------------------
+
+// Condition variable for coroutines running on the same io_context.
+// wait() suspends until the next notify_all(), so callers re-check their condition in a loop.
+class async_condition {
+public:
+    explicit async_condition(boost::asio::any_io_executor executor)
+        : timer(executor, boost::asio::steady_timer::time_point::max()) {}
+
+    void notify_all() {
+        timer.cancel();
+    }
+
+    awaitable<void> wait() {
+        boost::system::error_code ec;
+        co_await timer.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+    }
+
+private:
+    boost::asio::steady_timer timer;
+};
+
 awaitable<void> send_coroutine(tcp::socket& sock, int64_t value) {
     co_await boost::asio::async_write(sock, boost::asio::buffer(&value, sizeof(value)), use_awaitable);
 }
@@ -57,6 +102,45 @@ awaitable<std::vector<int64_t>> recv_vector(tcp::socket& sock) {
     co_return result;
 }
 
+// Send a vector to the peer while concurrently receiving the peer's vector.
+// Both parties call this at the same step, so the write is not awaited before the
+// read starts; otherwise two large messages would fill the socket buffers and deadlock.
+awaitable<std::vector<int64_t>> exchange_vector(tcp::socket& sock, const std::vector<int64_t>& vec) {
+    auto executor = co_await this_coro::executor;
+    async_condition write_done(executor);
+    bool write_finished = false;
+    std::exception_ptr write_error, read_error;
+
+    int64_t size = vec.size();
+    co_spawn(executor,
+        [&]() -> awaitable<void> {
+            co_await boost::asio::async_write(sock, boost::asio::buffer(&size, sizeof(size)), use_awaitable);
+            if (size > 0) {
+                co_await boost::asio::async_write(sock, boost::asio::buffer(vec, size * sizeof(int64_t)), use_awaitable);
+            }
+        },
+        [&](std::exception_ptr e) {
+            write_error = e;
+            write_finished = true;
+            write_done.notify_all();
+        });
+
+    std::vector<int64_t> result;
+    try {
+        result = co_await recv_vector(sock);
+    } catch (...) {
+        read_error = std::current_exception();
+    }
+
+    // The spawned writer references locals of this frame, so always wait for it
+    while (!write_finished) {
+        co_await write_done.wait();
+    }
+    if (read_error) std::rethrow_exception(read_error);
+    if (write_error) std::rethrow_exception(write_error);
+    co_return result;
+}
+
 // Setup connection to P2 (P0/P1 act as clients, P2 acts as server)
 awaitable<tcp::socket> setup_server_connection(boost::asio::io_context& io_context, tcp::resolver& resolver) {
     tcp::socket sock(io_context);
@@ -65,6 +149,13 @@ awaitable<tcp::socket> setup_server_connection(boost::asio::io_context& io_conte
     auto endpoints_p2 = resolver.resolve("p2", "9002");
     co_await boost::asio::async_connect(sock, endpoints_p2, use_awaitable);
 
+    // Tell P2 which party we are, P0 and P1 may connect in either order
+#ifdef ROLE_p0
+    co_await send_coroutine(sock, 0);
+#else
+    co_await send_coroutine(sock, 1);
+#endif
+
     co_return sock;
 }
 
@@ -79,8 +170,17 @@ awaitable<int64_t> recv_from_P2(tcp::socket& sock) {
 awaitable<tcp::socket> setup_peer_connection(boost::asio::io_context& io_context, tcp::resolver& resolver) {
     tcp::socket sock(io_context);
 #ifdef ROLE_p0
+    // P1 only starts listening once it has received its inputs from P2, so retry until it does
     auto endpoints_p1 = resolver.resolve("p1", "9001");
-    co_await boost::asio::async_connect(sock, endpoints_p1, use_awaitable);
+    boost::asio::steady_timer retry_timer(io_context);
+    while (true) {
+        boost::system::error_code ec;
+        co_await boost::asio::async_connect(sock, endpoints_p1, boost::asio::redirect_error(use_awaitable, ec));
+        if (!ec) break;
+        if (ec != boost::asio::error::connection_refused) throw boost::system::system_error(ec);
+        retry_timer.expires_after(std::chrono::milliseconds(100));
+        co_await retry_timer.async_wait(use_awaitable);
+    }
 #else
     tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), 9001));
     sock = co_await acceptor.async_accept(use_awaitable);
@@ -89,64 +189,66 @@ awaitable<tcp::socket> setup_peer_connection(boost::asio::io_context& io_context
 }
 
 
-// Generate random number between 1 and PRIME
+// Generate a uniformly random element of the ring R, e.g. a mask of a share
+template <typename R = share_ring>
 inline int64_t random_uint() {
     static std::random_device rd;
-    static std::mt19937_64 gen(rd());
-    static std::uniform_int_distribution<int64_t> dis(1, PRIME);
-    return dis(gen);
+    static std::mt19937_64 gen(((uint64_t)rd() << 32) ^ rd());
+    return (int64_t)R::random(gen);
 }
 
-// Receive a matrix from the server socket
-awaitable<std::vector<std::vector<int64_t>>> recv_matrix(tcp::socket& sock) {
-    // Read dimensions (rows, cols)
-    int64_t rows, cols;
-    co_await boost::asio::async_read(sock, boost::asio::buffer(&rows, sizeof(rows)), use_awaitable);
-    co_await boost::asio::async_read(sock, boost::asio::buffer(&cols, sizeof(cols)), use_awaitable);
-
-    // If either dimension is zero, return an empty matrix immediately
-    if (rows == 0 || cols == 0) {
-        co_return std::vector<std::vector<int64_t>>();
-    }
+// Generate a fresh 64-bit seed for a seeded_prg
+inline int64_t random_seed() {
+    static std::random_device rd;
+    return ((int64_t)rd() << 32) ^ rd();
+}
 
-    // Allocate a buffer to hold the flattened matrix data
-    std::vector<int64_t> flattened_data(rows * cols);
+// Deterministic generator of uniformly random elements of the ring R, so that P2 and a party
+// holding the same seed draw the same sequence of masks. The words come from the fixed-key AES
+// PRG of prg.hpp in counter mode (the words of expand_seed(seed)), a whole buffer at a time, so
+// the masks cannot be predicted from the ones a party has seen.
+template <typename R = share_ring>
+struct seeded_prg {
+    // A UniformRandomBitGenerator, so that R::random can draw from it
+    using result_type = uint64_t;
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return UINT64_MAX; }
 
-    // Read the entire matrix data in a single operation
-    co_await boost::asio::async_read(sock, boost::asio::buffer(flattened_data, flattened_data.size() * sizeof(int64_t)), use_awaitable);
+    explicit seeded_prg(int64_t seed) : seed(seed) {}
 
-    // Reshape the flattened data into a 2D matrix
-    std::vector<std::vector<int64_t>> matrix(rows, std::vector<int64_t>(cols));
-    for (size_t i = 0; i < rows; ++i) {
-        for (size_t j = 0; j < cols; ++j) {
-            matrix[i][j] = flattened_data[i * cols + j];
+    uint64_t operator()() {
+        if (position == BUFFER_WORDS) {
+            prg::mmo_counters(seed, counter, buffer, BUFFER_WORDS / 2);
+            counter += BUFFER_WORDS / 2;
+            position = 0;
         }
+        return buffer[position++];
     }
-    co_return matrix;
-}
 
+    int64_t next() {
+        return (int64_t)R::random(*this);
+    }
 
-// Send a matrix to the receiver socket
-awaitable<void> send_matrix(tcp::socket& sock, const std::vector<std::vector<int64_t>>& matrix) {
-    // Send dimensions (rows, cols) first
-    int64_t rows = matrix.size();
-    int64_t cols = (rows > 0) ? matrix[0].size() : 0;
-    co_await boost::asio::async_write(sock, boost::asio::buffer(&rows, sizeof(rows)), use_awaitable);
-    co_await boost::asio::async_write(sock, boost::asio::buffer(&cols, sizeof(cols)), use_awaitable);
-
-    // Flatten the 2D matrix into a 1D vector for a single write operation
-    std::vector<int64_t> flattened_data;
-    if (rows > 0 && cols > 0) {
-        flattened_data.reserve(rows * cols);
-        for (const auto& row : matrix) {
-            flattened_data.insert(flattened_data.end(), row.begin(), row.end());
+    void fill(span<int64_t> vec) {
+        for (auto& value : vec) {
+            value = next();
         }
     }
-    // Send the entire matrix data
-    co_await boost::asio::async_write(sock, boost::asio::buffer(flattened_data, flattened_data.size() * sizeof(int64_t)), use_awaitable);
-    co_return;
-}
 
+    vector<int64_t> next_vector(int size) {
+        vector<int64_t> vec(size);
+        fill(vec);
+        return vec;
+    }
+
+private:
+    static constexpr size_t BUFFER_WORDS = 64;
+
+    int64_t seed;
+    int64_t counter = 1;
+    size_t position = BUFFER_WORDS;
+    int64_t buffer[BUFFER_WORDS];
+};
 
 // Send a vector to the receiver socket
 awaitable<void> send_vector(tcp::socket& sock, const std::vector<int64_t>& vec) {
@@ -0,0 +1,168 @@
+#pragma once
+#include <vector>
+
+#include "common.hpp"
+#include "matrix_operations.hpp"
+#include "dpf.hpp"
+
+using namespace std;
+
+// Inputs and correlated randomness that P2 sends to a party for a single query
+struct query_correlations {
+    int64_t user_index;              // public index of the user row to update
+    vector<int64_t> item_share;      // share of the standard basis vector e_j
+    vector<int64_t> item_key;        // serialized DPF key of e_j in ITEM_SELECTION_DPF mode
+
+    // Du-Atallah shares for the k dot products that fetch V_j, k x n matrices
+    Matrix X;
+    Matrix Y;
+    vector<int64_t> Z;
+
+    // Du-Atallah shares for the dot product <U_i, V_j>
+    vector<int64_t> X_uv;
+    vector<int64_t> Y_uv;
+    int64_t Z_uv;
+
+    // Du-Atallah shares for the k multiplications delta * V_j
+    vector<int64_t> deltaX;
+    vector<int64_t> deltaY;
+    vector<int64_t> deltaZ;
+
+    int64_t share_of_1;              // share of the constant 1
+
+    int64_t seed = 0;                // PRG seed of the masks in PREPROCESSING_SEEDED mode
+};
+
+// Expand the masks of a query from its seed (PREPROCESSING_SEEDED mode).
+// Every party derives X, Y, X_uv, Y_uv, deltaX and deltaY. P0 also derives its Z values,
+// its share of 1 and its share of e_j (unless e_j comes from a DPF key), which P1 cannot,
+// so P2 sends P1 the matching corrections instead. P2 calls this with the same seeds to
+// learn what the parties hold.
+void expand_query_correlations(query_correlations& c, int party, const protocol_modes& modes) {
+    int k = no_of_features;
+    int n = no_of_items;
+    seeded_prg prg(c.seed);
+
+    c.X = Matrix(k, n);
+    c.Y = Matrix(k, n);
+    for (int i = 0; i < k; i++) {
+        prg.fill(c.X.row(i));
+        prg.fill(c.Y.row(i));
+    }
+    c.X_uv = prg.next_vector(k);
+    c.Y_uv = prg.next_vector(k);
+    c.deltaX = prg.next_vector(k);
+    c.deltaY = prg.next_vector(k);
+
+    if (party == 0) {
+        c.Z = prg.next_vector(k);
+        c.Z_uv = prg.next();
+        c.deltaZ = prg.next_vector(k);
+        c.share_of_1 = prg.next();
+        if (modes.item_selection == ITEM_SELECTION_DENSE) {
+            c.item_share = prg.next_vector(n);
+        }
+    }
+}
+
+// Drop everything a party expands from the seed, leaving what P2 still has to send
+void strip_expandable_correlations(query_correlations& c, int party) {
+    c.X.clear();
+    c.Y.clear();
+    c.X_uv.clear();
+    c.Y_uv.clear();
+    c.deltaX.clear();
+    c.deltaY.clear();
+    if (party == 0) {
+        c.Z.clear();
+        c.deltaZ.clear();
+        c.item_share.clear();
+    }
+}
+
+// Receive the inputs and correlations of the next query from P2
+// In ITEM_SELECTION_DPF mode the share of e_j is expanded from the received DPF key.
+awaitable<query_correlations> recv_query_correlations(tcp::socket& sock, const protocol_modes& modes, int party) {
+    query_correlations c;
+    co_await recv_coroutine(sock, c.user_index);
+
+    if (modes.item_selection == ITEM_SELECTION_DPF) {
+        c.item_key = co_await recv_vector(sock);
+        c.item_share = EvalFull(no_of_items, deserialize_dpf_key(c.item_key));
+    }
+
+    if (modes.preprocessing == PREPROCESSING_SEEDED) {
+        co_await recv_coroutine(sock, c.seed);
+        expand_query_correlations(c, party, modes);
+        if (party == 1) {
+            c.Z = co_await recv_vector(sock);
+            co_await recv_coroutine(sock, c.Z_uv);
+            c.deltaZ = co_await recv_vector(sock);
+            co_await recv_coroutine(sock, c.share_of_1);
+            if (modes.item_selection == ITEM_SELECTION_DENSE) {
+                c.item_share = co_await recv_vector(sock);
+            }
+        }
+        co_return c;
+    }
+
+    if (modes.item_selection == ITEM_SELECTION_DENSE) {
+        c.item_share = co_await recv_vector(sock);
+    }
+
+    c.X = co_await recv_matrix(sock);
+    c.Y = co_await recv_matrix(sock);
+    c.Z = co_await recv_vector(sock);
+
+    c.X_uv = co_await recv_vector(sock);
+    c.Y_uv = co_await recv_vector(sock);
+    co_await recv_coroutine(sock, c.Z_uv);
+
+    c.deltaX = co_await recv_vector(sock);
+    c.deltaY = co_await recv_vector(sock);
+    c.deltaZ = co_await recv_vector(sock);
+
+    co_await recv_coroutine(sock, c.share_of_1);
+    co_return c;
+}
+
+// Send the inputs and correlations of a query to a party, in the order recv_query_correlations reads them
+awaitable<void> send_query_correlations(tcp::socket& sock, const query_correlations& c, const protocol_modes& modes, int party) {
+    co_await send_coroutine(sock, c.user_index);
+
+    if (modes.item_selection == ITEM_SELECTION_DPF) {
+        co_await send_vector(sock, c.item_key);
+    }
+
+    if (modes.preprocessing == PREPROCESSING_SEEDED) {
+        co_await send_coroutine(sock, c.seed);
+        if (party == 1) {
+            co_await send_vector(sock, c.Z);
+            co_await send_coroutine(sock, c.Z_uv);
+            co_await send_vector(sock, c.deltaZ);
+            co_await send_coroutine(sock, c.share_of_1);
+            if (modes.item_selection == ITEM_SELECTION_DENSE) {
+                co_await send_vector(sock, c.item_share);
+            }
+        }
+        co_return;
+    }
+
+    if (modes.item_selection == ITEM_SELECTION_DENSE) {
+        co_await send_vector(sock, c.item_share);
+    }
+
+    co_await send_matrix(sock, c.X);
+    co_await send_matrix(sock, c.Y);
+    co_await send_vector(sock, c.Z);
+
+    co_await send_vector(sock, c.X_uv);
+    co_await send_vector(sock, c.Y_uv);
+    co_await send_coroutine(sock, c.Z_uv);
+
+    co_await send_vector(sock, c.deltaX);
+    co_await send_vector(sock, c.deltaY);
+    co_await send_vector(sock, c.deltaZ);
+
+    co_await send_coroutine(sock, c.share_of_1);
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <random>
+#include <vector>
+
+#include "common.hpp"
+#include "../../common/prg.hpp"
+
+using namespace std;
+
+/*
+Additive-output Distributed Point Function, adapted from the DPF of Assignment 2.
+The seeds are expanded with the fixed-key AES PRG shared with Assignment 2 (common/prg.hpp).
+The outputs of the two keys are additive shares in the ring R (share_ring by default, like the
+rest of the arithmetic here) of the point function that is target_value at target_index
+and 0 everywhere else. With target_value = 1 they are shares of the standard basis vector.
+A leaf seed is turned into a ring element with R::reduce.
+
+- root: The root seed of the DPF tree.
+- flag: The flag associated with the root seed.
+- party: 0 or 1, party 1 negates its outputs.
+- cw: A vector of correction words for each layer of the DPF tree.
+- fcw0: A vector of flag correction words for the left children in a layer.
+- fcw1: A vector of flag correction words for the right children in a layer.
+- final_cw: The correction word added to the leaves whose flag is set.
+*/
+struct dpf_key_type {
+    int64_t root;
+    uint8_t flag;
+    uint8_t party;
+    vector<int64_t> cw;
+    vector<uint8_t> fcw0;
+    vector<uint8_t> fcw1;
+    int64_t final_cw;
+};
+
+/*
+Generates the DPF keys of both parties for a domain of size domain_size.
+Only the seeds and flags on the path to target_index are expanded, so the keys cost O(log n).
+*/
+template <typename R = share_ring>
+vector<dpf_key_type> generateDPF(int64_t domain_size, int64_t target_index, int64_t target_value) {
+    assert(target_index >= 0 && target_index < domain_size);
+
+    int max_depth = 0;
+    while (((int64_t)1 << max_depth) < domain_size) {
+        max_depth++;
+    }
+
+    vector<dpf_key_type> dpf_keys(2);
+    dpf_keys[0].root = random_seed();
+    dpf_keys[1].root = random_seed();
+    dpf_keys[0].flag = random_seed() & 1;
+    dpf_keys[1].flag = dpf_keys[0].flag ^ 1;
+    dpf_keys[0].party = 0;
+    dpf_keys[1].party = 1;
+
+    // seeds and flags of both trees at the node on the path to the target
+    int64_t seed[2] = {dpf_keys[0].root, dpf_keys[1].root};
+    uint8_t flag[2] = {dpf_keys[0].flag, dpf_keys[1].flag};
+
+    for (int layer = 1; layer <= max_depth; layer++) {
+        // Determine direction to target node at current layer (0 means left, 1 means right)
+        int direction = (target_index >> (max_depth - layer)) & 1;
+
+        int64_t child_seed[2][2];
+        uint8_t child_flag[2][2];
+        for (int b = 0; b < 2; b++) {
+            length_doubling_PRG(seed[b], child_seed[b][0], child_seed[b][1]);
+            child_flag[b][0] = child_seed[b][0] & 1;
+            child_flag[b][1] = child_seed[b][1] & 1;
+        }
+
+        // the seed correction word makes the children off the path equal in both trees, and
+        // the flag correction words keep the flags on the path different and the ones off it equal
+        int lose = direction ^ 1;
+        int64_t cw = child_seed[0][lose] ^ child_seed[1][lose];
+        uint8_t fcw[2];
+        fcw[lose] = child_flag[0][lose] ^ child_flag[1][lose];
+        fcw[direction] = child_flag[0][direction] ^ child_flag[1][direction] ^ 1;
+
+        for (int b = 0; b < 2; b++) {
+            dpf_keys[b].cw.push_back(cw);
+            dpf_keys[b].fcw0.push_back(fcw[0]);
+            dpf_keys[b].fcw1.push_back(fcw[1]);
+        }
+
+        for (int b = 0; b < 2; b++) {
+            int64_t next_seed = child_seed[b][direction];
+            uint8_t next_flag = child_flag[b][direction];
+            if (flag[b]) {
+                next_seed ^= cw;
+                next_flag ^= fcw[direction];
+            }
+            seed[b] = next_seed;
+            flag[b] = next_flag;
+        }
+    }
+
+    // exactly one of the two flags at the target leaf is set, party 1 negates its output
+    assert(flag[0] != flag[1]);
+    uint64_t difference = R::sub(R::add(R::from_signed(target_value), R::reduce(seed[1])), R::reduce(seed[0]));
+    int64_t final_cw = (int64_t)(flag[1] ? R::sub(0, difference) : difference);
+    dpf_keys[0].final_cw = final_cw;
+    dpf_keys[1].final_cw = final_cw;
+    return dpf_keys;
+}
+
+/*
+Evaluates a DPF key at every index of the domain and returns this party's additive shares.
+The seeds of a layer are expanded together, so that the AES blocks are pipelined.
+Throws runtime_error if the tree of the key has fewer leaves than the domain.
+*/
+template <typename R = share_ring>
+vector<int64_t> EvalFull(int64_t domain_size, const dpf_key_type& dpf_key) {
+    int max_depth = dpf_key.cw.size();
+    if (max_depth > 62 || ((int64_t)1 << max_depth) < domain_size) {
+        throw runtime_error("the DPF key of depth " + to_string(max_depth) + " does not cover " + to_string(domain_size) + " items");
+    }
+
+    vector<int64_t> seeds(1, dpf_key.root), new_seeds;
+    vector<uint8_t> flags(1, dpf_key.flag), new_flags;
+
+    for (int layer = 0; layer < max_depth; layer++) {
+        int64_t n = seeds.size();
+        new_seeds.resize(2 * n);
+        new_flags.resize(2 * n);
+        length_doubling_PRG(seeds.data(), new_seeds.data(), n);
+        for (int64_t i = 0; i < n; i++) {
+            int64_t& left = new_seeds[2 * i];
+            int64_t& right = new_seeds[2 * i + 1];
+            uint8_t left_flag = left & 1, right_flag = right & 1;
+            if (flags[i]) {
+                left ^= dpf_key.cw[layer];
+                right ^= dpf_key.cw[layer];
+                left_flag ^= dpf_key.fcw0[layer];
+                right_flag ^= dpf_key.fcw1[layer];
+            }
+            new_flags[2 * i] = left_flag;
+            new_flags[2 * i + 1] = right_flag;
+        }
+        swap(seeds, new_seeds);
+        swap(flags, new_flags);
+    }
+
+    // apply final correction word and trim to domain size
+    vector<int64_t> result(domain_size);
+    for (int64_t i = 0; i < domain_size; i++) {
+        uint64_t value = R::add(R::reduce(seeds[i]), flags[i] ? (uint64_t)dpf_key.final_cw : 0);
+        result[i] = (int64_t)(dpf_key.party ? R::sub(0, value) : value);
+    }
+    return result;
+}
+
+/*
+Flattens a DPF key into [root, flag, party, final_cw, depth, cw..., flag correction words...]
+so that it can be sent with send_vector. Both flag correction words of a layer share one word.
+*/
+vector<int64_t> serialize_dpf_key(const dpf_key_type& dpf_key) {
+    int depth = dpf_key.cw.size();
+    vector<int64_t> data = {dpf_key.root, dpf_key.flag, dpf_key.party, dpf_key.final_cw, depth};
+    data.insert(data.end(), dpf_key.cw.begin(), dpf_key.cw.end());
+    for (int layer = 0; layer < depth; layer++) {
+        data.push_back(dpf_key.fcw0[layer] | (dpf_key.fcw1[layer] << 1));
+    }
+    return data;
+}
+
+// Throws runtime_error if the words are not a serialized key
+dpf_key_type deserialize_dpf_key(const vector<int64_t>& data) {
+    if (data.size() < 5 || data[4] < 0 || data[4] > 62 || data.size() != 5 + 2 * (size_t)data[4]) {
+        throw runtime_error("malformed DPF key of " + to_string(data.size()) + " words");
+    }
+    if ((data[1] != 0 && data[1] != 1) || (data[2] != 0 && data[2] != 1)) {
+        throw runtime_error("malformed DPF key: the flag and the party must be 0 or 1");
+    }
+    dpf_key_type dpf_key;
+    dpf_key.root = data[0];
+    dpf_key.flag = data[1];
+    dpf_key.party = data[2];
+    dpf_key.final_cw = data[3];
+    int depth = data[4];
+    dpf_key.cw.assign(data.begin() + 5, data.begin() + 5 + depth);
+    for (int layer = 0; layer < depth; layer++) {
+        int64_t fcw = data[5 + depth + layer];
+        dpf_key.fcw0.push_back(fcw & 1);
+        dpf_key.fcw1.push_back((fcw >> 1) & 1);
+    }
+    return dpf_key;
+}
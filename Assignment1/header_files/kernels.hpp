@@ -0,0 +1,323 @@
+#pragma once
+#include <bits/stdc++.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+using namespace std;
+
+/*
+Vector kernels for the two rings the protocols run over:
+  - Z_2^64: wraparound arithmetic on uint64_t, the ring of the Du-Atallah shares.
+  - Z_p for the Mersenne prime p = 2^61 - 1: inputs in [0, p], outputs reduced to [0, p).
+    Products are folded lazily (2^61 = 1 mod p) and only fully reduced once per output.
+
+Every kernel has a scalar version and AVX2 and AVX-512 versions selected at runtime (the vector
+versions are only compiled on x86). All versions compute exact ring results, so they are
+bit-identical, which self_check.cpp verifies at every SIMD level the processor supports.
+*/
+
+enum simd_level {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512 = 2,
+};
+
+simd_level detect_simd_level() {
+#ifdef KERNELS_X86
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+// The kernels used by every call, can be lowered (e.g. to compare against the scalar versions)
+simd_level SIMD_LEVEL = detect_simd_level();
+
+const uint64_t MERSENNE_61 = (uint64_t(1) << 61) - 1;
+
+/*------------- Scalar kernels ---------------*/
+
+// x mod p up to a small multiple of p: the result is below 2^61 + 8 for any 64-bit x
+inline uint64_t fold_mersenne61(uint64_t x) {
+    return (x & MERSENNE_61) + (x >> 61);
+}
+
+// Canonical representative in [0, p) of x < 2^64
+inline uint64_t reduce_mersenne61(uint64_t x) {
+    x = fold_mersenne61(fold_mersenne61(x));
+    return x >= MERSENNE_61 ? x - MERSENNE_61 : x;
+}
+
+// a * b mod p for a, b < 2^61, lazily reduced to below 2^63.
+// With a = a1 2^32 + a0 and b = b1 2^32 + b0 (a1, b1 < 2^29), and 2^64 = 8 mod p:
+// a * b = 8 a1 b1 + (a1 b0 + a0 b1) 2^32 + a0 b0 mod p
+inline uint64_t mul_lazy_mersenne61(uint64_t a, uint64_t b) {
+    uint64_t a0 = a & 0xffffffff, a1 = a >> 32;
+    uint64_t b0 = b & 0xffffffff, b1 = b >> 32;
+    uint64_t low = a0 * b0;
+    uint64_t mid = a1 * b0 + a0 * b1;
+    uint64_t high = a1 * b1;
+    return (low & MERSENNE_61) + (low >> 61) + ((mid & ((uint64_t(1) << 29) - 1)) << 32) + (mid >> 29) + (high << 3);
+}
+
+// Sum of the lazily reduced lanes of a vector accumulator and a reduced tail, reduced to [0, p)
+inline uint64_t sum_lanes_mersenne61(const uint64_t* lanes, size_t count, uint64_t tail) {
+    uint64_t sum = tail;
+    for (size_t i = 0; i < count; i++) {
+        sum = fold_mersenne61(sum + lanes[i]);
+    }
+    return reduce_mersenne61(sum);
+}
+
+uint64_t dot_product_ring64_scalar(const uint64_t* a, const uint64_t* b, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+uint64_t dot_product_mersenne61_scalar(const uint64_t* a, const uint64_t* b, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum = fold_mersenne61(sum + mul_lazy_mersenne61(a[i], b[i]));
+    }
+    return reduce_mersenne61(sum);
+}
+
+void axpy_ring64_scalar(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void axpy_mersenne61_scalar(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] = reduce_mersenne61(fold_mersenne61(y[i]) + mul_lazy_mersenne61(alpha, x[i]));
+    }
+}
+
+#ifdef KERNELS_X86
+/*------------- AVX2 kernels ---------------*/
+
+// Low 64 bits of the lane-wise products, from three 32x32 bit multiplications
+__attribute__((target("avx2")))
+inline __m256i mullo_epi64_avx2(__m256i a, __m256i b) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+inline __m256i fold_mersenne61_avx2(__m256i x) {
+    return _mm256_add_epi64(_mm256_and_si256(x, _mm256_set1_epi64x(MERSENNE_61)), _mm256_srli_epi64(x, 61));
+}
+
+__attribute__((target("avx2")))
+inline __m256i mul_lazy_mersenne61_avx2(__m256i a, __m256i b) {
+    __m256i a1 = _mm256_srli_epi64(a, 32), b1 = _mm256_srli_epi64(b, 32);
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i mid = _mm256_add_epi64(_mm256_mul_epu32(a1, b), _mm256_mul_epu32(a, b1));
+    __m256i high = _mm256_mul_epu32(a1, b1);
+    __m256i sum = fold_mersenne61_avx2(low);
+    sum = _mm256_add_epi64(sum, _mm256_slli_epi64(_mm256_and_si256(mid, _mm256_set1_epi64x((1 << 29) - 1)), 32));
+    sum = _mm256_add_epi64(sum, _mm256_srli_epi64(mid, 29));
+    return _mm256_add_epi64(sum, _mm256_slli_epi64(high, 3));
+}
+
+__attribute__((target("avx2")))
+uint64_t dot_product_ring64_avx2(const uint64_t* a, const uint64_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        acc = _mm256_add_epi64(acc, mullo_epi64_avx2(va, vb));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_product_ring64_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+uint64_t dot_product_mersenne61_avx2(const uint64_t* a, const uint64_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        acc = fold_mersenne61_avx2(_mm256_add_epi64(acc, mul_lazy_mersenne61_avx2(va, vb)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return sum_lanes_mersenne61(lanes, 4, dot_product_mersenne61_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx2")))
+void axpy_ring64_avx2(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    __m256i valpha = _mm256_set1_epi64x(alpha);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i vx = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i vy = _mm256_loadu_si256((const __m256i*)(y + i));
+        _mm256_storeu_si256((__m256i*)(y + i), _mm256_add_epi64(vy, mullo_epi64_avx2(valpha, vx)));
+    }
+    axpy_ring64_scalar(alpha, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void axpy_mersenne61_avx2(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    __m256i valpha = _mm256_set1_epi64x(alpha);
+    __m256i p = _mm256_set1_epi64x(MERSENNE_61);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i vx = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i vy = _mm256_loadu_si256((const __m256i*)(y + i));
+        __m256i sum = _mm256_add_epi64(fold_mersenne61_avx2(vy), mul_lazy_mersenne61_avx2(valpha, vx));
+        sum = fold_mersenne61_avx2(fold_mersenne61_avx2(sum));
+        // sum - p if sum >= p, the values are below 2^62 so the signed comparison is exact
+        __m256i below = _mm256_cmpgt_epi64(p, sum);
+        sum = _mm256_sub_epi64(sum, _mm256_andnot_si256(below, p));
+        _mm256_storeu_si256((__m256i*)(y + i), sum);
+    }
+    axpy_mersenne61_scalar(alpha, x + i, y + i, n - i);
+}
+
+/*------------- AVX-512 kernels ---------------*/
+
+// GCC 12 warns that the undefined pass-through operand of the inlined shift and multiply intrinsics
+// may be used uninitialized, it is never read since no lane is masked
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+inline __m512i fold_mersenne61_avx512(__m512i x) {
+    return _mm512_add_epi64(_mm512_and_si512(x, _mm512_set1_epi64(MERSENNE_61)), _mm512_srli_epi64(x, 61));
+}
+
+__attribute__((target("avx512f")))
+inline __m512i mul_lazy_mersenne61_avx512(__m512i a, __m512i b) {
+    __m512i a1 = _mm512_srli_epi64(a, 32), b1 = _mm512_srli_epi64(b, 32);
+    __m512i low = _mm512_mul_epu32(a, b);
+    __m512i mid = _mm512_add_epi64(_mm512_mul_epu32(a1, b), _mm512_mul_epu32(a, b1));
+    __m512i high = _mm512_mul_epu32(a1, b1);
+    __m512i sum = fold_mersenne61_avx512(low);
+    sum = _mm512_add_epi64(sum, _mm512_slli_epi64(_mm512_and_si512(mid, _mm512_set1_epi64((1 << 29) - 1)), 32));
+    sum = _mm512_add_epi64(sum, _mm512_srli_epi64(mid, 29));
+    return _mm512_add_epi64(sum, _mm512_slli_epi64(high, 3));
+}
+
+__attribute__((target("avx512f,avx512dq")))
+uint64_t dot_product_ring64_avx512(const uint64_t* a, const uint64_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        acc = _mm512_add_epi64(acc, _mm512_mullo_epi64(va, vb));
+    }
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, acc);
+    uint64_t sum = dot_product_ring64_scalar(a + i, b + i, n - i);
+    for (uint64_t lane : lanes) {
+        sum += lane;
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+uint64_t dot_product_mersenne61_avx512(const uint64_t* a, const uint64_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        acc = fold_mersenne61_avx512(_mm512_add_epi64(acc, mul_lazy_mersenne61_avx512(va, vb)));
+    }
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, acc);
+    return sum_lanes_mersenne61(lanes, 8, dot_product_mersenne61_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx512f,avx512dq")))
+void axpy_ring64_avx512(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    __m512i valpha = _mm512_set1_epi64(alpha);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vy = _mm512_loadu_si512(y + i);
+        _mm512_storeu_si512(y + i, _mm512_add_epi64(vy, _mm512_mullo_epi64(valpha, vx)));
+    }
+    axpy_ring64_scalar(alpha, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+void axpy_mersenne61_avx512(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    __m512i valpha = _mm512_set1_epi64(alpha);
+    __m512i p = _mm512_set1_epi64(MERSENNE_61);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vy = _mm512_loadu_si512(y + i);
+        __m512i sum = _mm512_add_epi64(fold_mersenne61_avx512(vy), mul_lazy_mersenne61_avx512(valpha, vx));
+        sum = fold_mersenne61_avx512(fold_mersenne61_avx512(sum));
+        sum = _mm512_mask_sub_epi64(sum, _mm512_cmpge_epu64_mask(sum, p), sum, p);
+        _mm512_storeu_si512(y + i, sum);
+    }
+    axpy_mersenne61_scalar(alpha, x + i, y + i, n - i);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+/*------------- Dispatch ---------------*/
+
+// sum of a[i] * b[i] in Z_2^64
+uint64_t dot_product_ring64(const uint64_t* a, const uint64_t* b, size_t n) {
+    switch (SIMD_LEVEL) {
+#ifdef KERNELS_X86
+        case SIMD_AVX512: return dot_product_ring64_avx512(a, b, n);
+        case SIMD_AVX2: return dot_product_ring64_avx2(a, b, n);
+#endif
+        default: return dot_product_ring64_scalar(a, b, n);
+    }
+}
+
+// sum of a[i] * b[i] mod 2^61 - 1, for inputs in [0, 2^61 - 1]
+uint64_t dot_product_mersenne61(const uint64_t* a, const uint64_t* b, size_t n) {
+    switch (SIMD_LEVEL) {
+#ifdef KERNELS_X86
+        case SIMD_AVX512: return dot_product_mersenne61_avx512(a, b, n);
+        case SIMD_AVX2: return dot_product_mersenne61_avx2(a, b, n);
+#endif
+        default: return dot_product_mersenne61_scalar(a, b, n);
+    }
+}
+
+// y += alpha * x in Z_2^64
+void axpy_ring64(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    switch (SIMD_LEVEL) {
+#ifdef KERNELS_X86
+        case SIMD_AVX512: axpy_ring64_avx512(alpha, x, y, n); break;
+        case SIMD_AVX2: axpy_ring64_avx2(alpha, x, y, n); break;
+#endif
+        default: axpy_ring64_scalar(alpha, x, y, n);
+    }
+}
+
+// y = y + alpha * x mod 2^61 - 1, for inputs in [0, 2^61 - 1]
+void axpy_mersenne61(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+    switch (SIMD_LEVEL) {
+#ifdef KERNELS_X86
+        case SIMD_AVX512: axpy_mersenne61_avx512(alpha, x, y, n); break;
+        case SIMD_AVX2: axpy_mersenne61_avx2(alpha, x, y, n); break;
+#endif
+        default: axpy_mersenne61_scalar(alpha, x, y, n);
+    }
+}
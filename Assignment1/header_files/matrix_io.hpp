@@ -0,0 +1,299 @@
+#pragma once
+#include <bits/stdc++.h>
+#include <bit>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matrix_operations.hpp"
+
+using namespace std;
+
+/*
+Files holding the initial matrices U (m x k) and V (n x k) that P2 secret-shares.
+
+Text format: an optional header line "# m n k", then the m*k entries of U and the n*k entries of V
+row by row, separated by whitespace. Without the header the dimensions come from the command line.
+
+Binary format, version 1, made of 64-bit little-endian words:
+  0: magic "UVMATRIX"
+  1: version
+  2: m (# of users), 3: n (# of items), 4: k (# of features)
+  then the entries of U and V row-major, (m + n) * k words
+A binary file is memory mapped and U and V are read in place, nothing is parsed.
+*/
+const uint64_t MATRIX_FILE_MAGIC = 0x58495254414d5655; // "UVMATRIX"
+const uint64_t MATRIX_FILE_VERSION = 1;
+const size_t MATRIX_FILE_HEADER_WORDS = 5;
+const size_t PARSE_PIECE_BYTES = 1 << 20; // smallest piece of a text file given to a parser thread
+const int64_t MAX_MATRIX_DIMENSION = INT_MAX; // the dimensions are kept in int, see common.hpp
+
+static_assert(std::endian::native == std::endian::little, "binary matrix files are read in place as little-endian words");
+
+// Dimensions of U and V, 0 where unknown
+struct matrix_dimensions {
+    int64_t users = 0;
+    int64_t items = 0;
+    int64_t features = 0;
+};
+
+// Number of entries of U and V, (m + n) * k. Every dimension is at most MAX_MATRIX_DIMENSION,
+// so the product cannot overflow 64 bits.
+inline uint64_t matrix_entries(const matrix_dimensions& dims) {
+    return ((uint64_t)dims.users + (uint64_t)dims.items) * (uint64_t)dims.features;
+}
+
+// Read-only memory mapping of a whole file
+class mapped_file {
+public:
+    explicit mapped_file(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("cannot open " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("cannot read " + path + ": " + strerror(errno));
+        }
+        mapping_size = st.st_size;
+        if (mapping_size > 0) {
+            mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw runtime_error("cannot map " + path + ": " + strerror(errno));
+        }
+        // The file is read once, front to back
+        if (mapping) {
+            madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    ~mapped_file() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+        }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    size_t size() const { return mapping_size; }
+    const char* data() const { return (const char*)mapping; }
+    string_view text() const { return {data(), mapping_size}; }
+
+private:
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+};
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+// Number of whitespace separated tokens in text
+size_t count_tokens(string_view text) {
+    size_t count = 0;
+    bool in_token = false;
+    for (char c : text) {
+        bool space = is_space(c);
+        count += !space && !in_token;
+        in_token = !space;
+    }
+    return count;
+}
+
+// Parses the whitespace separated integers of text into out, which must have room for all of them
+void parse_tokens(string_view text, int64_t* out) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (true) {
+        while (p != end && is_space(*p)) {
+            p++;
+        }
+        if (p == end) {
+            return;
+        }
+        if (*p == '+') {
+            p++;
+        }
+        auto [next, ec] = from_chars(p, end, *out);
+        if (ec != errc() || (next != end && !is_space(*next))) {
+            const char* token_end = find_if(p, end, is_space);
+            throw runtime_error("not a 64-bit integer: '" + string(p, token_end) + "'");
+        }
+        out++;
+        p = next;
+    }
+}
+
+/*
+A function that parses the whitespace separated integers of text into values, which must hold
+exactly as many values as the text. The text is cut into pieces at whitespace, one per thread:
+every thread first counts the tokens of its piece, which gives the position of its first value,
+and then parses its piece with from_chars. Throws runtime_error if a token is not an integer or
+the number of tokens differs from values.size().
+*/
+void parse_integers(string_view text, span<int64_t> values, unsigned threads) {
+    size_t pieces = max<size_t>(1, min<size_t>(threads, text.size() / PARSE_PIECE_BYTES));
+    vector<size_t> cuts(pieces + 1, text.size());
+    cuts[0] = 0;
+    for (size_t t = 1; t < pieces; t++) {
+        size_t cut = max(cuts[t - 1], text.size() * t / pieces);
+        while (cut < text.size() && !is_space(text[cut])) {
+            cut++;
+        }
+        cuts[t] = cut;
+    }
+
+    // Runs f(t) for every piece t on its own thread and rethrows the first exception
+    auto for_each_piece = [&](auto f) {
+        vector<exception_ptr> errors(pieces);
+        vector<thread> workers;
+        for (size_t t = 1; t < pieces; t++) {
+            workers.emplace_back([&, t]() {
+                try {
+                    f(t);
+                } catch (...) {
+                    errors[t] = current_exception();
+                }
+            });
+        }
+        try {
+            f(0);
+        } catch (...) {
+            errors[0] = current_exception();
+        }
+        for (thread& worker : workers) {
+            worker.join();
+        }
+        for (exception_ptr& error : errors) {
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+    };
+
+    vector<size_t> first_value(pieces + 1, 0);
+    for_each_piece([&](size_t t) {
+        first_value[t + 1] = count_tokens(text.substr(cuts[t], cuts[t + 1] - cuts[t]));
+    });
+    partial_sum(first_value.begin(), first_value.end(), first_value.begin());
+    if (first_value[pieces] != values.size()) {
+        throw runtime_error("expected " + to_string(values.size()) + " matrix entries, found " + to_string(first_value[pieces]));
+    }
+
+    for_each_piece([&](size_t t) {
+        parse_tokens(text.substr(cuts[t], cuts[t + 1] - cuts[t]), values.data() + first_value[t]);
+    });
+}
+
+/*
+The initial matrices U and V loaded from a text or binary file, the format is detected from the
+magic word. The dimensions come from the header of the file or, when a text file has none, from
+requested; a dimension in both must agree. U and V are views that live as long as the matrix_file.
+*/
+class matrix_file {
+public:
+    matrix_file(const string& path, matrix_dimensions requested, unsigned threads) : file(path) {
+        string_view text = file.text();
+        if (file.size() >= sizeof(uint64_t) && *(const uint64_t*)file.data() == MATRIX_FILE_MAGIC) {
+            load_binary(path);
+            check_dimensions(requested);
+            return;
+        }
+
+        // Optional header line "# m n k"
+        size_t start = text.find_first_not_of(" \t\r\n");
+        if (start != string_view::npos && text[start] == '#') {
+            size_t line_end = min(text.find('\n', start), text.size());
+            int64_t header[3];
+            try {
+                parse_integers(text.substr(start + 1, line_end - start - 1), header, 1);
+            } catch (const runtime_error&) {
+                throw runtime_error(path + ": the header must be '# <users> <items> <features>'");
+            }
+            dims = {header[0], header[1], header[2]};
+            text = text.substr(line_end);
+        }
+        check_dimensions(requested);
+
+        // Every entry takes at least one character, a header claiming more is rejected before allocating
+        if (matrix_entries(dims) > text.size()) {
+            throw runtime_error(path + ": expected " + to_string(matrix_entries(dims)) + " matrix entries, the file is too short");
+        }
+
+        // U and V are stored one after the other, as in the binary format
+        parsed = Matrix(dims.users + dims.items, dims.features);
+        parse_integers(text, parsed.flat(), threads);
+        values = parsed.data();
+    }
+
+    matrix_dimensions dimensions() const { return dims; }
+    MatrixView U() const { return {values, (size_t)dims.users, (size_t)dims.features}; }
+    MatrixView V() const { return {values + dims.users * dims.features, (size_t)dims.items, (size_t)dims.features}; }
+
+private:
+    void load_binary(const string& path) {
+        const uint64_t* words = (const uint64_t*)file.data();
+        if (file.size() < MATRIX_FILE_HEADER_WORDS * sizeof(uint64_t) || file.size() % sizeof(uint64_t) != 0) {
+            throw runtime_error(path + ": truncated matrix file");
+        }
+        if (words[1] != MATRIX_FILE_VERSION) {
+            throw runtime_error(path + ": unsupported matrix file version " + to_string(words[1]));
+        }
+        for (int i = 2; i < 5; i++) {
+            if (words[i] == 0 || words[i] > (uint64_t)MAX_MATRIX_DIMENSION) {
+                throw runtime_error(path + ": invalid matrix dimension " + to_string(words[i]));
+            }
+        }
+        dims = {(int64_t)words[2], (int64_t)words[3], (int64_t)words[4]};
+        uint64_t entries = file.size() / sizeof(uint64_t) - MATRIX_FILE_HEADER_WORDS;
+        if (entries != matrix_entries(dims)) {
+            throw runtime_error(path + ": the size of the matrix file does not match its dimensions");
+        }
+        values = (const int64_t*)(words + MATRIX_FILE_HEADER_WORDS);
+    }
+
+    // Fill in the dimensions the file does not give from requested, and check the others agree
+    void check_dimensions(matrix_dimensions requested) {
+        int64_t* given[3] = {&dims.users, &dims.items, &dims.features};
+        int64_t wanted[3] = {requested.users, requested.items, requested.features};
+        const char* names[3] = {"users", "items", "features"};
+        for (int i = 0; i < 3; i++) {
+            if (*given[i] == 0) {
+                *given[i] = wanted[i];
+            } else if (wanted[i] != 0 && wanted[i] != *given[i]) {
+                throw runtime_error(string("the input has ") + to_string(*given[i]) + " " + names[i] + ", not " + to_string(wanted[i]));
+            }
+            if (*given[i] <= 0) {
+                throw runtime_error(string("the number of ") + names[i] + " is not given by the input file or the command line");
+            }
+            if (*given[i] > MAX_MATRIX_DIMENSION) {
+                throw runtime_error(string("the number of ") + names[i] + " is larger than " + to_string(MAX_MATRIX_DIMENSION));
+            }
+        }
+    }
+
+    mapped_file file;
+    matrix_dimensions dims;
+    Matrix parsed;
+    const int64_t* values = nullptr;
+};
+
+// Write U and V in the binary format, so that later runs map them instead of parsing text
+void write_matrix_file(const string& path, MatrixView U, MatrixView V) {
+    assert(U.cols() == V.cols());
+    ofstream fout(path, ios::binary);
+    uint64_t header[MATRIX_FILE_HEADER_WORDS] = {MATRIX_FILE_MAGIC, MATRIX_FILE_VERSION, U.rows(), V.rows(), U.cols()};
+    fout.write((const char*)header, sizeof(header));
+    fout.write((const char*)U.data(), U.size() * sizeof(int64_t));
+    fout.write((const char*)V.data(), V.size() * sizeof(int64_t));
+    if (!fout) {
+        throw runtime_error("cannot write " + path);
+    }
+}
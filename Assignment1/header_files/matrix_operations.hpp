@@ -9,9 +9,121 @@
 #include <vector>
 
 #include "common.hpp"
+#include "ring.hpp"
 
 using namespace std;
 
+// Dense row-major matrix of int64_t stored in a single contiguous buffer.
+// Row i occupies [i * cols, (i + 1) * cols) of data(), so a row is a span and the whole
+// matrix can be sent or received with a single read/write.
+class Matrix;
+
+// Non-owning read-only view of a row-major matrix, cheap to pass by value
+struct MatrixView {
+    const int64_t* values = nullptr;
+    size_t n_rows = 0;
+    size_t n_cols = 0;
+
+    size_t rows() const { return n_rows; }
+    size_t cols() const { return n_cols; }
+    size_t size() const { return n_rows * n_cols; }
+    const int64_t* data() const { return values; }
+    span<const int64_t> flat() const { return {values, size()}; }
+    span<const int64_t> row(size_t i) const { return {values + i * n_cols, n_cols}; }
+    int64_t operator()(size_t i, size_t j) const { return values[i * n_cols + j]; }
+};
+
+class Matrix {
+public:
+    Matrix() = default;
+    Matrix(size_t rows, size_t cols, int64_t value = 0) : n_rows(rows), n_cols(cols), values(rows * cols, value) {}
+
+    // Copy of a nested matrix, whose rows must all have the same length
+    Matrix(const vector<vector<int64_t>>& nested) : Matrix(nested.size(), nested.empty() ? 0 : nested[0].size()) {
+        for (size_t i = 0; i < n_rows; i++) {
+            assert(nested[i].size() == n_cols);
+            copy(nested[i].begin(), nested[i].end(), row(i).begin());
+        }
+    }
+
+    size_t rows() const { return n_rows; }
+    size_t cols() const { return n_cols; }
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+    int64_t* data() { return values.data(); }
+    const int64_t* data() const { return values.data(); }
+    span<int64_t> flat() { return values; }
+    span<const int64_t> flat() const { return values; }
+    span<int64_t> row(size_t i) { return {values.data() + i * n_cols, n_cols}; }
+    span<const int64_t> row(size_t i) const { return {values.data() + i * n_cols, n_cols}; }
+    int64_t& operator()(size_t i, size_t j) { return values[i * n_cols + j]; }
+    int64_t operator()(size_t i, size_t j) const { return values[i * n_cols + j]; }
+
+    MatrixView view() const { return {values.data(), n_rows, n_cols}; }
+    operator MatrixView() const { return view(); }
+
+    // Release the memory, leaving a 0 x 0 matrix
+    void clear() {
+        n_rows = n_cols = 0;
+        values = vector<int64_t>();
+    }
+
+private:
+    size_t n_rows = 0;
+    size_t n_cols = 0;
+    vector<int64_t> values;
+};
+
+// Receive a matrix from the server socket directly into a contiguous Matrix
+awaitable<Matrix> recv_matrix(tcp::socket& sock) {
+    // Read dimensions (rows, cols)
+    int64_t dims[2];
+    co_await boost::asio::async_read(sock, boost::asio::buffer(dims, sizeof(dims)), use_awaitable);
+
+    // If either dimension is zero, return an empty matrix immediately
+    if (dims[0] == 0 || dims[1] == 0) {
+        co_return Matrix();
+    }
+
+    // Read the entire matrix data in a single operation
+    Matrix matrix(dims[0], dims[1]);
+    co_await boost::asio::async_read(sock, boost::asio::buffer(matrix.data(), matrix.size() * sizeof(int64_t)), use_awaitable);
+    co_return matrix;
+}
+
+// Send a matrix to the receiver socket, the rows are already contiguous
+awaitable<void> send_matrix(tcp::socket& sock, MatrixView matrix) {
+    // Send dimensions (rows, cols) first
+    int64_t dims[2] = {(int64_t)matrix.rows(), (int64_t)matrix.cols()};
+    if (matrix.size() == 0) {
+        dims[0] = dims[1] = 0;
+    }
+    co_await boost::asio::async_write(sock, boost::asio::buffer(dims, sizeof(dims)), use_awaitable);
+
+    // Send the entire matrix data
+    if (matrix.size() > 0) {
+        co_await boost::asio::async_write(sock, boost::asio::buffer(matrix.data(), matrix.size() * sizeof(int64_t)), use_awaitable);
+    }
+    co_return;
+}
+
+Matrix matrix_transpose(MatrixView A) {
+    Matrix At(A.cols(), A.rows());
+    for (size_t i = 0; i < A.rows(); ++i) {
+        for (size_t j = 0; j < A.cols(); ++j) {
+            At(j, i) = A(i, j);
+        }
+    }
+    return At;
+}
+
+// Receive a matrix and return it transposed, i.e. stored column-major, so that its
+// columns are contiguous and can be read as spans with row()
+awaitable<Matrix> recv_matrix_transposed(tcp::socket& sock) {
+    Matrix matrix = co_await recv_matrix(sock);
+    co_return matrix_transpose(matrix);
+}
+
 // Generate standared basis vector of given size with 1 at given index
 vector<int64_t> standared_basis_vector(int size, int index){
     vector<int64_t> vec(size,0);
@@ -19,76 +131,120 @@ vector<int64_t> standared_basis_vector(int size, int index){
     return vec;
 }
 
-// Generate random number between 1 and PRIME
+// Fill a vector with uniformly random elements of the ring R
+template <typename R = share_ring>
+void fill_random(span<int64_t> vec){
+    for(auto& value : vec){
+        value = random_uint<R>();
+    }
+}
+
+// Generate a vector of uniformly random elements of the ring R
+template <typename R = share_ring>
 vector<int64_t> random_vector(int size){
     vector<int64_t> vec(size);
-    for(int i=0;i<size;i++){
-        vec[i] = random_uint();
-        // DEBUGGING
-        // vec[i] = 1;
-    }
+    fill_random<R>(vec);
     return vec;
 }
 
-// checks if two vectors are additive shares or not
-vector<int64_t> check_Subtraction_vectors(vector<int64_t> vec1, vector<int64_t> vec2){
+// checks if two vectors are additive shares (in the ring R) of a 0/1 vector or not
+template <typename R = share_ring>
+vector<int64_t> check_Subtraction_vectors(span<const int64_t> vec1, span<const int64_t> vec2){
     int size = vec1.size();
     vector<int64_t> result(size);
     for(int i=0;i<size;i++){
-        result[i] = vec1[i] + vec2[i];
-        assert(result[i]==0 || result[i]==1);
+        R sum = R::from_word(vec1[i]) + R::from_word(vec2[i]);
+        assert(sum == R(0) || sum == R(1));
+        result[i] = sum.share();
     }
     return result;
 }
 
+// The entries of A as elements of the ring R, e.g. the signed entries of an input matrix
+template <typename R = share_ring>
+Matrix matrix_from_signed(MatrixView A) {
+    Matrix C(A.rows(), A.cols());
+    for (size_t i = 0; i < A.size(); ++i) {
+        C.data()[i] = (int64_t)R::from_signed(A.data()[i]);
+    }
+    return C;
+}
 
-// performs element-wise subtraction of two vectors vec1 and vec2
-vector<int64_t> SUB_vectors(vector<int64_t> vec1, vector<int64_t> vec2){
-    int size = vec1.size();
-    vector<int64_t> result(size);
-    for(int i=0;i<size;i++){
-        result[i] = vec1[i] - vec2[i];
+
+// The arithmetic helpers below are templated on the ring R of the shares (share_ring by default).
+// A share is stored as the int64_t word holding its representative, and the words are handed to
+// R as uint64_t, so that Z_2^64 arithmetic wraps around instead of being undefined behaviour.
+inline const uint64_t* ring_words(const int64_t* values) { return reinterpret_cast<const uint64_t*>(values); }
+inline uint64_t* ring_words(int64_t* values) { return reinterpret_cast<uint64_t*>(values); }
+
+// a[i] = op(a[i], b[i]) for two arrays of ring words
+template <typename Op>
+void elementwise_inplace(int64_t* a, const int64_t* b, size_t n, Op op) {
+    uint64_t* x = ring_words(a);
+    const uint64_t* y = ring_words(b);
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = op(x[i], y[i]);
     }
+}
+
+// performs element-wise subtraction of two vectors vec1 and vec2
+template <typename R = share_ring>
+vector<int64_t> SUB_vectors(span<const int64_t> vec1, span<const int64_t> vec2){
+    assert(vec2.size() == vec1.size());
+    vector<int64_t> result(vec1.begin(), vec1.end());
+    elementwise_inplace(result.data(), vec2.data(), result.size(), [](uint64_t a, uint64_t b) { return R::sub(a, b); });
     return result;
 }
 
 
 // create shares of standard basis vector for a given vector
+template <typename R = share_ring>
 vector<vector<int64_t>> create_standard_basis_vec_shares(int len, int index) {
-    vector<int64_t> vec = standared_basis_vector(len, index);
-    vector<int64_t> share1 = random_vector(len);
-    vector<int64_t> share2 = SUB_vectors(vec, share1);
-    check_Subtraction_vectors(share1, share2);
-    return {share1, share2};
+    vector<int64_t> share1 = random_vector<R>(len);
+    vector<int64_t> share2 = SUB_vectors<R>(standared_basis_vector(len, index), share1);
+    check_Subtraction_vectors<R>(share1, share2);
+    return {std::move(share1), std::move(share2)};
 }
 
 // performs dot product of two vectors A and B
-int64_t vector_dot_product(vector<int64_t> A, vector<int64_t> B) {
-    int size = A.size();
-    assert(B.size() == size);
-    int64_t vec = 0;
-    for (int i = 0; i < size; ++i) {
-        vec += (A[i] * B[i]);
-    }
-    return vec;
+template <typename R = share_ring>
+int64_t vector_dot_product(span<const int64_t> A, span<const int64_t> B) {
+    assert(B.size() == A.size());
+    return (int64_t)R::dot(ring_words(A.data()), ring_words(B.data()), A.size());
+}
+
+// y += alpha * x element-wise
+template <typename R = share_ring>
+void vector_axpy(int64_t alpha, span<const int64_t> x, span<int64_t> y) {
+    assert(x.size() == y.size());
+    R::axpy((uint64_t)alpha, ring_words(x.data()), ring_words(y.data()), x.size());
+}
+
+// A += B element-wise
+template <typename R = share_ring>
+void matrix_add_inplace(Matrix& A, MatrixView B) {
+    assert(A.rows() == B.rows() && A.cols() == B.cols());
+    elementwise_inplace(A.data(), B.data(), A.size(), [](uint64_t a, uint64_t b) { return R::add(a, b); });
 }
 
 // Performs element-wise addition of two matrices A and B
-vector<vector<int64_t>> matrix_addition(vector<vector<int64_t>> A, vector<vector<int64_t>> B) {
-    int rows = A.size();
-    int cols = A[0].size();
-    assert(B.size() == rows && B[0].size() == cols);
-    vector<vector<int64_t>> C(rows, vector<int64_t>(cols));
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            C[i][j] = A[i][j] + B[i][j];
-        }
-    }
+template <typename R = share_ring>
+Matrix matrix_addition(MatrixView A, MatrixView B) {
+    Matrix C(A.rows(), A.cols());
+    copy(A.flat().begin(), A.flat().end(), C.data());
+    matrix_add_inplace<R>(C, B);
     return C;
 }
 
+// Reuses the storage of A when it is a temporary
+template <typename R = share_ring>
+Matrix matrix_addition(Matrix&& A, MatrixView B) {
+    matrix_add_inplace<R>(A, B);
+    return std::move(A);
+}
+
 // performs element-wise XOR of two vectors vec1 and vec2
-vector<int64_t> XOR_vectors(vector<int64_t> vec1, vector<int64_t> vec2){
+vector<int64_t> XOR_vectors(span<const int64_t> vec1, span<const int64_t> vec2){
     int size = vec1.size();
     vector<int64_t> result(size);
     for(int i=0;i<size;i++){
@@ -98,7 +254,7 @@ vector<int64_t> XOR_vectors(vector<int64_t> vec1, vector<int64_t> vec2){
 }
 
 // check if two vectors are XOR shares or not
-vector<int64_t> check_XOR_vectors(vector<int64_t> vec1, vector<int64_t> vec2){
+vector<int64_t> check_XOR_vectors(span<const int64_t> vec1, span<const int64_t> vec2){
     int size = vec1.size();
     vector<int64_t> result(size);
     for(int i=0;i<size;i++){
@@ -108,149 +264,237 @@ vector<int64_t> check_XOR_vectors(vector<int64_t> vec1, vector<int64_t> vec2){
     return result;
 }
 
-// creates random value matrix of shape rows x cols
+// creates random value matrix of shape rows x cols, the values are uniform in the ring R
 // if randomize=1, creates random matrix
 // DEBUGGING
 // if randomize=2, sends TEST_U
 // if randomize=3, sends TEST_V
-vector<vector<int64_t>> create_random_matrix(int rows,int cols,int randomize){
+template <typename R = share_ring>
+Matrix create_random_matrix(int rows,int cols,int randomize){
     if(randomize!=1){
-        return randomize == 2 ? TEST_U : TEST_V;
-    }
-    vector<vector<int64_t>> matrix(rows,vector<int64_t>(cols));
-    for(int i=0;i<rows;i++){
-        for(int j=0;j<cols;j++){
-            matrix[i][j] = random_uint();
-        }
+        return Matrix(randomize == 2 ? TEST_U : TEST_V);
     }
+    Matrix matrix(rows, cols);
+    fill_random<R>(matrix.flat());
     return matrix;
 }
 
 // checks if two matrices are XOR shares or not
-void check_XOR_matrices(vector<vector<int64_t>> A, vector<vector<int64_t>> B){
-    int rows = A.size();
-    int cols = A[0].size();
-    for(int i=0;i<rows;i++){
-        for(int j=0;j<cols;j++){
-            int64_t val = A[i][j] ^ B[i][j];
-            assert(val==0);
-        }
+void check_XOR_matrices(MatrixView A, MatrixView B){
+    assert(A.rows() == B.rows() && A.cols() == B.cols());
+    for(size_t i=0;i<A.size();i++){
+        int64_t val = A.data()[i] ^ B.data()[i];
+        assert(val==0);
     }
 }
 
 // performs element-wise XOR of two matrices A and B
-vector<vector<int64_t>> matrix_XOR(vector<vector<int64_t>> A, vector<vector<int64_t>> B) {
-    int rows = A.size();
-    int cols = A[0].size();
-    vector<vector<int64_t>> C(rows, vector<int64_t>(cols));
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            C[i][j] = A[i][j] ^ B[i][j];
-        }
+Matrix matrix_XOR(MatrixView A, MatrixView B) {
+    assert(A.rows() == B.rows() && A.cols() == B.cols());
+    Matrix C(A.rows(), A.cols());
+    for (size_t i = 0; i < C.size(); ++i) {
+        C.data()[i] = A.data()[i] ^ B.data()[i];
     }
     return C;
 }
 
+// A -= B element-wise
+template <typename R = share_ring>
+void matrix_subtract_inplace(Matrix& A, MatrixView B) {
+    assert(A.rows() == B.rows() && A.cols() == B.cols());
+    elementwise_inplace(A.data(), B.data(), A.size(), [](uint64_t a, uint64_t b) { return R::sub(a, b); });
+}
+
 // performs element-wise subtraction of two matrices A and B
-vector<vector<int64_t>> matrix_subtraction(vector<vector<int64_t>> A, vector<vector<int64_t>> B) {
-    int rows = A.size();
-    int cols = A[0].size();
-    vector<vector<int64_t>> C(rows, vector<int64_t>(cols));
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            C[i][j] = A[i][j] - B[i][j];
-        }
-    }
+template <typename R = share_ring>
+Matrix matrix_subtraction(MatrixView A, MatrixView B) {
+    Matrix C(A.rows(), A.cols());
+    copy(A.flat().begin(), A.flat().end(), C.data());
+    matrix_subtract_inplace<R>(C, B);
     return C;
 }
 
+// Reuses the storage of A when it is a temporary
+template <typename R = share_ring>
+Matrix matrix_subtraction(Matrix&& A, MatrixView B) {
+    matrix_subtract_inplace<R>(A, B);
+    return std::move(A);
+}
+
 // checks if two matrices are additive shares or not
 // SPECIAL CASE: checks if A+B = matrix of all 0s initialized for debugging purposes
-void check_Additive_matrices(vector<vector<int64_t>> A, vector<vector<int64_t>> B){
-    int rows = A.size();
-    int cols = A[0].size();
-    for(int i=0;i<rows;i++){
-        for(int j=0;j<cols;j++){
-            int64_t val = A[i][j] + B[i][j];
-            // assert(val==0);
-        }
+template <typename R = share_ring>
+void check_Additive_matrices(MatrixView A, MatrixView B){
+    for(size_t i=0;i<A.size();i++){
+        R val = R::from_word(A.data()[i]) + R::from_word(B.data()[i]);
+        // assert(val == R(0));
     }
 }
 
 
 // performs matrix-vector multiplication of matrix A and vector B
-vector<int64_t> matrix_vector_multiplication(vector<vector<int64_t>> A, vector<int64_t> B) {
-    int rows = A.size();
-    int cols = A[0].size();
-    assert(B.size() == cols);
-    vector<int64_t> C(rows, 0);
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            C[i] += (A[i][j] * B[j]);
-        }
+template <typename R = share_ring>
+vector<int64_t> matrix_vector_multiplication(MatrixView A, span<const int64_t> B) {
+    assert(B.size() == A.cols());
+    vector<int64_t> C(A.rows());
+    for (size_t i = 0; i < A.rows(); ++i) {
+        C[i] = vector_dot_product<R>(A.row(i), B);
     }
     return C;
 }
 
-vector<int64_t> vector_addition(vector<int64_t> A, vector<int64_t> B) {
-    int size = A.size();
-    assert(B.size() == size);
-    vector<int64_t> C(size);
-    for (int i = 0; i < size; ++i) {
-        C[i] = A[i] + B[i];
-    }
+// A += B element-wise
+template <typename R = share_ring>
+void vector_add_inplace(span<int64_t> A, span<const int64_t> B) {
+    assert(B.size() == A.size());
+    elementwise_inplace(A.data(), B.data(), A.size(), [](uint64_t a, uint64_t b) { return R::add(a, b); });
+}
+
+template <typename R = share_ring>
+vector<int64_t> vector_addition(span<const int64_t> A, span<const int64_t> B) {
+    vector<int64_t> C(A.begin(), A.end());
+    vector_add_inplace<R>(C, B);
     return C;
 }
 
-vector<vector<int64_t>> matrix_transpose(vector<vector<int64_t>> A) {
-    int rows = A.size();
-    int cols = A[0].size();
-    vector<vector<int64_t>> At(cols, vector<int64_t>(rows));
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            At[j][i] = A[i][j];
-        }
+// Reuses the storage of A when it is a temporary
+template <typename R = share_ring>
+vector<int64_t> vector_addition(vector<int64_t>&& A, span<const int64_t> B) {
+    vector_add_inplace<R>(A, B);
+    return std::move(A);
+}
+
+
+// The per-query vectors of length k (rows of U, V_j and their masks) are templated on the
+// feature dimension K. A fixed K makes them std::array blocks whose loops fully unroll,
+// dynamic_extent keeps k a runtime value.
+template <size_t K>
+using feature_row = conditional_t<K == dynamic_extent, vector<int64_t>, array<int64_t, K>>;
+
+template <size_t K>
+feature_row<K> make_feature_row(size_t k) {
+    if constexpr (K == dynamic_extent) {
+        return vector<int64_t>(k);
+    } else {
+        assert(k == K);
+        return {};
     }
-    return At;
 }
 
-// Performs MPC dot product of two vectors vec1 and vec2
-awaitable<int64_t> mpc_dot_product(vector<int64_t> vec1, vector<int64_t> vec2, vector<int64_t> X, vector<int64_t> Y, int64_t Z, tcp::socket& peer_socket) {
+// A row of k features as a span of extent K
+template <size_t K>
+span<int64_t, K> feature_span(span<int64_t> row) {
+    assert(K == dynamic_extent || row.size() == K);
+    return span<int64_t, K>(row.data(), row.size());
+}
 
-    vector<int64_t> Xtilde = vector_addition(vec1, X);
-    vector<int64_t> Ytilde = vector_addition(vec2, Y);
+template <size_t K>
+span<const int64_t, K> feature_span(span<const int64_t> row) {
+    assert(K == dynamic_extent || row.size() == K);
+    return span<const int64_t, K>(row.data(), row.size());
+}
 
-    // Send Xtilde and Ytilde to peer and receive peer's Xtilde and Ytilde
-    co_await send_vector(peer_socket, Xtilde);
-    co_await send_vector(peer_socket, Ytilde);
+// Calls f(i) for every feature i < k, unrolled at compile time when K is fixed
+template <size_t K, typename F>
+inline void for_each_feature(size_t k, F&& f) {
+    if constexpr (K == dynamic_extent) {
+        for (size_t i = 0; i < k; ++i) {
+            f(i);
+        }
+    } else {
+        [&]<size_t... I>(index_sequence<I...>) { (f(I), ...); }(make_index_sequence<K>{});
+    }
+}
 
-    vector<int64_t> Xtilde_peer = co_await recv_vector(peer_socket);
-    vector<int64_t> Ytilde_peer = co_await recv_vector(peer_socket);
+// A += B for two rows of k features
+template <size_t K, typename R = share_ring>
+void feature_add_inplace(span<int64_t, K> A, span<const int64_t, K> B) {
+    assert(B.size() == A.size());
+    uint64_t* x = ring_words(A.data());
+    const uint64_t* y = ring_words(B.data());
+    for_each_feature<K>(A.size(), [&](size_t i) { x[i] = R::add(x[i], y[i]); });
+}
 
+// Performs MPC dot product of two vectors vec1 and vec2
+// The peer is either the socket to the other party or the channel of a single query
+// The vectors have k elements, see feature_row
+template <size_t K = dynamic_extent, typename R = share_ring, typename Peer>
+awaitable<int64_t> mpc_dot_product(type_identity_t<span<const int64_t, K>> vec1, type_identity_t<span<const int64_t, K>> vec2, type_identity_t<span<const int64_t, K>> X, type_identity_t<span<const int64_t, K>> Y, int64_t Z, Peer& peer_socket) {
+    size_t n = vec1.size();
+    assert(vec2.size() == n && X.size() == n && Y.size() == n);
+
+    // Send Xtilde and Ytilde to peer and receive peer's Xtilde and Ytilde in one message
+    // Message layout: [vec1+X, vec2+Y]
+    vector<int64_t> message(2 * n);
+    for_each_feature<K>(n, [&](size_t i) {
+        message[i] = (int64_t)R::add(vec1[i], X[i]);
+        message[n + i] = (int64_t)R::add(vec2[i], Y[i]);
+    });
+    vector<int64_t> peer_message = co_await exchange_vector(peer_socket, message);
+    assert(peer_message.size() == message.size());
+
+    const int64_t* Xtilde_peer = peer_message.data();
+    const int64_t* Ytilde_peer = peer_message.data() + n;
+
+    // <vec1, vec2 + Ytilde_peer> - <Y, Xtilde_peer> + Z in a single pass
+    uint64_t U_row_dot_V_row_share = Z;
+    for_each_feature<K>(n, [&](size_t i) {
+        uint64_t term = R::sub(R::mul(vec1[i], R::add(vec2[i], Ytilde_peer[i])), R::mul(Y[i], Xtilde_peer[i]));
+        U_row_dot_V_row_share = R::add(U_row_dot_V_row_share, term);
+    });
+    co_return (int64_t)U_row_dot_V_row_share;
+}
 
-    assert(Xtilde_peer.size() == Xtilde.size());
-    assert(Ytilde_peer.size() == Ytilde.size());
+// Performs k MPC dot products <A[i], vec> in a single round, i.e. the product of the
+// k x n matrix A with the vector vec. X[i], Y[i] and Z[i] are the Du-Atallah shares for
+// the i-th dot product. All masked rows are sent to the peer as one message.
+template <typename R = share_ring, typename Peer>
+awaitable<vector<int64_t>> mpc_matrix_vector_product(MatrixView A, span<const int64_t> vec, MatrixView X, MatrixView Y, span<const int64_t> Z, Peer& peer_socket) {
+    size_t k = A.rows();
+    size_t n = vec.size();
+    assert(A.cols() == n && X.rows() == k && X.cols() == n && Y.rows() == k && Y.cols() == n && Z.size() == k);
+
+    // Message layout: [A[0]+X[0], ..., A[k-1]+X[k-1], vec+Y[0], ..., vec+Y[k-1]]
+    vector<int64_t> message(2 * k * n);
+    for (size_t i = 0; i < k; i++) {
+        span<int64_t> Xtilde(message.data() + i * n, n), Ytilde(message.data() + (k + i) * n, n);
+        copy(A.row(i).begin(), A.row(i).end(), Xtilde.begin());
+        vector_add_inplace<R>(Xtilde, X.row(i));
+        copy(vec.begin(), vec.end(), Ytilde.begin());
+        vector_add_inplace<R>(Ytilde, Y.row(i));
+    }
 
-    int64_t x_dot_y_plus_Ytilde_peer = vector_dot_product(vec1,vector_addition(vec2, Ytilde_peer));
-    int64_t Y_dot_Xtilde_peer = vector_dot_product(Y,Xtilde_peer);
-    int64_t U_row_dot_V_row_share = x_dot_y_plus_Ytilde_peer - Y_dot_Xtilde_peer + Z;
-    co_return U_row_dot_V_row_share;
+    vector<int64_t> peer_message = co_await exchange_vector(peer_socket, message);
+    assert(peer_message.size() == message.size());
+
+    // share_i = <A[i], vec + Ytilde_peer[i]> - <Y[i], Xtilde_peer[i]> + Z[i], two length n dot products
+    vector<int64_t> result(k);
+    vector<int64_t> vec_plus_Ytilde_peer(n);
+    for (size_t i = 0; i < k; i++) {
+        span<const int64_t> Xtilde_peer(peer_message.data() + i * n, n);
+        span<const int64_t> Ytilde_peer(peer_message.data() + (k + i) * n, n);
+        copy(vec.begin(), vec.end(), vec_plus_Ytilde_peer.begin());
+        vector_add_inplace<R>(vec_plus_Ytilde_peer, Ytilde_peer);
+        uint64_t share = R::sub(vector_dot_product<R>(A.row(i), vec_plus_Ytilde_peer), vector_dot_product<R>(Y.row(i), Xtilde_peer));
+        result[i] = (int64_t)R::add(share, Z[i]);
+    }
+    co_return result;
 }
 
 // Fetch a specific column from a matrix
-vector<int64_t> fetch_column_from_matrix(vector<vector<int64_t>> matrix, int col_index) {
-    int rows = matrix.size();
-    vector<int64_t> column(rows);
-    for (int i = 0; i < rows; ++i) {
-        column[i] = matrix[i][col_index];
+vector<int64_t> fetch_column_from_matrix(MatrixView matrix, size_t col_index) {
+    vector<int64_t> column(matrix.rows());
+    for (size_t i = 0; i < matrix.rows(); ++i) {
+        column[i] = matrix(i, col_index);
     }
     return column;
 }
 
 // Performs MPC multiplication of two values x and y
+template <typename R = share_ring>
 awaitable<int64_t> mpc_multiplication(int64_t x, int64_t y, int64_t X, int64_t Y, int64_t Z, tcp::socket& peer_socket) {
-    int64_t X_tilde = X + x;
-    int64_t Y_tilde = Y + y;
+    int64_t X_tilde = (int64_t)R::add(X, x);
+    int64_t Y_tilde = (int64_t)R::add(Y, y);
 
     // Send a_plus_x and b_plus_y to peer and receive peer's a_plus_x and b_plus_y
     co_await send_coroutine(peer_socket, X_tilde);
@@ -261,6 +505,32 @@ awaitable<int64_t> mpc_multiplication(int64_t x, int64_t y, int64_t X, int64_t Y
     co_await recv_coroutine(peer_socket, X_tilde_peer);
     co_await recv_coroutine(peer_socket, Y_tilde_peer);
 
-    int64_t product_share = x * (y + Y_tilde_peer) - Y * X_tilde_peer + Z;
+    int64_t product_share = (int64_t)R::add(R::sub(R::mul(x, R::add(y, Y_tilde_peer)), R::mul(Y, X_tilde_peer)), Z);
     co_return product_share;
 }
+
+// Performs MPC multiplication of every element of vec with the scalar x in a single round.
+// X[i], Y[i] and Z[i] are the Du-Atallah shares for the i-th product, and the masked
+// vector and the masked scalars are sent to the peer as one message. vec has k elements, see feature_row.
+template <size_t K = dynamic_extent, typename R = share_ring, typename Peer>
+awaitable<feature_row<K>> mpc_vector_scalar_multiplication(type_identity_t<span<const int64_t, K>> vec, int64_t x, type_identity_t<span<const int64_t, K>> X, type_identity_t<span<const int64_t, K>> Y, type_identity_t<span<const int64_t, K>> Z, Peer& peer_socket) {
+    size_t k = vec.size();
+    assert(X.size() == k && Y.size() == k && Z.size() == k);
+
+    // Message layout: [vec[0]+X[0], ..., vec[k-1]+X[k-1], x+Y[0], ..., x+Y[k-1]]
+    vector<int64_t> message(2 * k);
+    for_each_feature<K>(k, [&](size_t i) {
+        message[i] = (int64_t)R::add(vec[i], X[i]);
+        message[k + i] = (int64_t)R::add(x, Y[i]);
+    });
+
+    vector<int64_t> peer_message = co_await exchange_vector(peer_socket, message);
+    assert(peer_message.size() == message.size());
+
+    feature_row<K> result = make_feature_row<K>(k);
+    for_each_feature<K>(k, [&](size_t i) {
+        uint64_t share = R::sub(R::mul(vec[i], R::add(x, peer_message[k + i])), R::mul(Y[i], peer_message[i]));
+        result[i] = (int64_t)R::add(share, Z[i]);
+    });
+    co_return result;
+}
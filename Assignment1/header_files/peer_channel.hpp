@@ -0,0 +1,131 @@
+#pragma once
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "common.hpp"
+
+using namespace std;
+
+// Multiplexes the messages of many concurrently running queries over the single socket
+// between P0 and P1. Every message is framed as [query_id, size, payload]. A reader
+// coroutine files the incoming messages by query id and a writer coroutine sends the
+// queued messages one after another, so the writes of different queries never interleave.
+class peer_channel {
+public:
+    explicit peer_channel(tcp::socket& sock)
+        : sock(sock), outbox_ready(sock.get_executor()), inbox_ready(sock.get_executor()) {}
+
+    // Spawn the reader and writer coroutines
+    void start() {
+        auto executor = sock.get_executor();
+        co_spawn(executor, reader(), detached);
+        co_spawn(executor, writer(), detached);
+    }
+
+    // Queue a message of the given query, it is sent in the background
+    void send(int64_t query_id, std::vector<int64_t> message) {
+        outbox.emplace_back(query_id, std::move(message));
+        outbox_ready.notify_all();
+    }
+
+    // Wait for the next message of the given query
+    awaitable<std::vector<int64_t>> recv(int64_t query_id) {
+        while (true) {
+            auto it = inbox.find(query_id);
+            if (it != inbox.end()) {
+                std::vector<int64_t> message = std::move(it->second.front());
+                it->second.pop_front();
+                if (it->second.empty()) {
+                    inbox.erase(it);
+                }
+                co_return message;
+            }
+            if (reader_error) std::rethrow_exception(reader_error);
+            if (reader_done) throw std::runtime_error("peer closed the connection");
+            co_await inbox_ready.wait();
+        }
+    }
+
+    // Flush the queued messages, then close our sending side and wait for the peer to do the same
+    awaitable<void> close() {
+        closing = true;
+        outbox_ready.notify_all();
+        while (!writer_done || !reader_done) {
+            co_await inbox_ready.wait();
+        }
+        if (reader_error) std::rethrow_exception(reader_error);
+        if (writer_error) std::rethrow_exception(writer_error);
+    }
+
+private:
+    awaitable<void> reader() {
+        try {
+            while (true) {
+                int64_t header[2];
+                boost::system::error_code ec;
+                co_await boost::asio::async_read(sock, boost::asio::buffer(header, sizeof(header)), boost::asio::redirect_error(use_awaitable, ec));
+                if (ec == boost::asio::error::eof) {
+                    break;
+                }
+                if (ec) throw boost::system::system_error(ec);
+
+                std::vector<int64_t> message(header[1]);
+                if (header[1] > 0) {
+                    co_await boost::asio::async_read(sock, boost::asio::buffer(message, message.size() * sizeof(int64_t)), use_awaitable);
+                }
+                inbox[header[0]].push_back(std::move(message));
+                inbox_ready.notify_all();
+            }
+        } catch (...) {
+            reader_error = std::current_exception();
+        }
+        reader_done = true;
+        inbox_ready.notify_all();
+    }
+
+    awaitable<void> writer() {
+        try {
+            while (true) {
+                if (outbox.empty()) {
+                    if (closing) break;
+                    co_await outbox_ready.wait();
+                    continue;
+                }
+                auto [query_id, message] = std::move(outbox.front());
+                outbox.pop_front();
+
+                int64_t header[2] = {query_id, (int64_t)message.size()};
+                std::array<boost::asio::const_buffer, 2> buffers = {
+                    boost::asio::buffer(header, sizeof(header)),
+                    boost::asio::buffer(message, message.size() * sizeof(int64_t))
+                };
+                co_await boost::asio::async_write(sock, buffers, use_awaitable);
+            }
+            sock.shutdown(tcp::socket::shutdown_send);
+        } catch (...) {
+            writer_error = std::current_exception();
+        }
+        writer_done = true;
+        inbox_ready.notify_all();
+    }
+
+    tcp::socket& sock;
+    std::deque<std::pair<int64_t, std::vector<int64_t>>> outbox;
+    std::map<int64_t, std::deque<std::vector<int64_t>>> inbox;
+    async_condition outbox_ready, inbox_ready;
+    bool closing = false, reader_done = false, writer_done = false;
+    std::exception_ptr reader_error, writer_error;
+};
+
+// The view of the peer channel that a single query works with
+struct query_channel {
+    peer_channel& channel;
+    int64_t query_id;
+};
+
+// Send a vector to the peer and receive the peer's vector for the same query
+awaitable<std::vector<int64_t>> exchange_vector(query_channel& peer, const std::vector<int64_t>& vec) {
+    peer.channel.send(peer.query_id, vec);
+    co_return co_await peer.channel.recv(peer.query_id);
+}
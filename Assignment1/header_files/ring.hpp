@@ -0,0 +1,171 @@
+#pragma once
+#include <bits/stdc++.h>
+
+#include "kernels.hpp"
+
+using namespace std;
+
+/*
+Rings the shares can live in, chosen at compile time.
+
+A Ring<Modulus> element is a 64-bit word holding the canonical representative of the element,
+so shares are still sent and stored as int64_t words. The static word operations (add, sub, mul,
+dot, axpy) are what the matrix helpers and the Du-Atallah routines call. The reduction of each
+modulus is picked with `if constexpr`, so no generic `%` is left in the hot loops:
+  - modulus_2_64: no reduction at all, the words wrap around.
+  - mersenne_modulus<B>: p = 2^B - 1, reduced by shift and add since 2^B = 1 mod p.
+  - prime_modulus<P>: any other modulus below 2^63, reduced with a 128-bit `%`.
+*/
+
+struct modulus_2_64 {};
+
+template <int Bits>
+struct mersenne_modulus {
+    static_assert(Bits >= 2 && Bits <= 61, "the Mersenne prime must fit in 61 bits");
+    static constexpr uint64_t value = (uint64_t(1) << Bits) - 1;
+};
+
+template <uint64_t P>
+struct prime_modulus {
+    static_assert(P >= 2 && P < (uint64_t(1) << 63), "the modulus must fit in 63 bits");
+    static constexpr uint64_t value = P;
+};
+
+template <typename Modulus>
+struct Ring {
+    static constexpr bool wraps = is_same_v<Modulus, modulus_2_64>;
+
+    uint64_t value = 0;
+
+    Ring() = default;
+    explicit Ring(int64_t x) : value(from_signed(x)) {}
+
+    // The modulus, 0 standing for 2^64
+    static constexpr uint64_t modulus() {
+        if constexpr (wraps) {
+            return 0;
+        } else {
+            return Modulus::value;
+        }
+    }
+
+    // Canonical representative of any 64-bit word read as an unsigned number
+    static uint64_t reduce(uint64_t x) {
+        if constexpr (wraps) {
+            return x;
+        } else if constexpr (is_same_v<Modulus, mersenne_modulus<61>>) {
+            return reduce_mersenne61(x);
+        } else if constexpr (requires { Modulus::value; } && (Modulus::value & (Modulus::value + 1)) == 0) {
+            // Any other Mersenne modulus, 2^B = 1 mod p
+            constexpr int bits = __builtin_popcountll(Modulus::value);
+            while (x > Modulus::value) {
+                x = (x & Modulus::value) + (x >> bits);
+            }
+            return x == Modulus::value ? 0 : x;
+        } else {
+            return x % Modulus::value;
+        }
+    }
+
+    // Element represented by a signed integer, e.g. a negative entry of an input matrix
+    static uint64_t from_signed(int64_t x) {
+        if constexpr (wraps) {
+            return (uint64_t)x;
+        } else {
+            uint64_t magnitude = reduce(x < 0 ? 0 - (uint64_t)x : (uint64_t)x);
+            return x < 0 && magnitude != 0 ? modulus() - magnitude : magnitude;
+        }
+    }
+
+    // Uniformly random element, the masks of the shares are drawn with it
+    template <typename Generator>
+    static uint64_t random(Generator& gen) {
+        uniform_int_distribution<uint64_t> dis(0, wraps ? UINT64_MAX : modulus() - 1);
+        return dis(gen);
+    }
+
+    static uint64_t add(uint64_t a, uint64_t b) {
+        if constexpr (wraps) {
+            return a + b;
+        } else {
+            uint64_t sum = a + b; // below 2^64 since both are below 2^63
+            return sum >= modulus() ? sum - modulus() : sum;
+        }
+    }
+
+    static uint64_t sub(uint64_t a, uint64_t b) {
+        if constexpr (wraps) {
+            return a - b;
+        } else {
+            return a >= b ? a - b : a + modulus() - b;
+        }
+    }
+
+    static uint64_t mul(uint64_t a, uint64_t b) {
+        if constexpr (wraps) {
+            return a * b;
+        } else if constexpr (is_same_v<Modulus, mersenne_modulus<61>>) {
+            return reduce_mersenne61(mul_lazy_mersenne61(a, b));
+        } else {
+            unsigned __int128 product = (unsigned __int128)a * b;
+            if constexpr ((Modulus::value & (Modulus::value + 1)) == 0) {
+                constexpr int bits = __builtin_popcountll(Modulus::value);
+                uint64_t low = (uint64_t)product & Modulus::value;
+                uint64_t high = (uint64_t)(product >> bits); // below 2^(2 bits - bits)
+                return reduce(low + high);
+            } else {
+                return (uint64_t)(product % Modulus::value);
+            }
+        }
+    }
+
+    // sum of a[i] * b[i], the two rings with vector kernels use them
+    static uint64_t dot(const uint64_t* a, const uint64_t* b, size_t n) {
+        if constexpr (wraps) {
+            return dot_product_ring64(a, b, n);
+        } else if constexpr (is_same_v<Modulus, mersenne_modulus<61>>) {
+            return dot_product_mersenne61(a, b, n);
+        } else {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                sum = add(sum, mul(a[i], b[i]));
+            }
+            return sum;
+        }
+    }
+
+    // y += alpha * x
+    static void axpy(uint64_t alpha, const uint64_t* x, uint64_t* y, size_t n) {
+        if constexpr (wraps) {
+            axpy_ring64(alpha, x, y, n);
+        } else if constexpr (is_same_v<Modulus, mersenne_modulus<61>>) {
+            axpy_mersenne61(alpha, x, y, n);
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                y[i] = add(y[i], mul(alpha, x[i]));
+            }
+        }
+    }
+
+    // The element as a signed word, as it is stored in the matrices and sent over the sockets
+    int64_t share() const { return (int64_t)value; }
+
+    static Ring from_word(uint64_t word) {
+        Ring r;
+        r.value = word;
+        return r;
+    }
+
+    friend Ring operator+(Ring a, Ring b) { return from_word(add(a.value, b.value)); }
+    friend Ring operator-(Ring a, Ring b) { return from_word(sub(a.value, b.value)); }
+    friend Ring operator*(Ring a, Ring b) { return from_word(mul(a.value, b.value)); }
+    Ring operator-() const { return from_word(sub(0, value)); }
+    Ring& operator+=(Ring b) { return *this = *this + b; }
+    Ring& operator-=(Ring b) { return *this = *this - b; }
+    Ring& operator*=(Ring b) { return *this = *this * b; }
+    friend bool operator==(Ring a, Ring b) { return a.value == b.value; }
+};
+
+// The ring the shares of U and V live in. Z_2^64 makes the wraparound of int64_t the ring
+// arithmetic. Assignment 2 uses the Mersenne prime 2^61 - 1, i.e. Ring<mersenne_modulus<61>>.
+using share_ring = Ring<modulus_2_64>;
@@ -1,5 +1,8 @@
 #include "header_files/common.hpp"
 #include "header_files/matrix_operations.hpp"
+#include "header_files/correlations.hpp"
+#include "header_files/bounded_queue.hpp"
+#include "header_files/matrix_io.hpp"
 #include <boost/asio.hpp>
 #include <iostream>
 #include <random>
@@ -14,35 +17,22 @@ void run_in_parallel(boost::asio::io_context& io, Fs&&... funcs) {
     (boost::asio::co_spawn(io, funcs, boost::asio::detached), ...);
 }
 
-// Read initial U and V matrices from input file
-vector<vector<vector<int64_t>>> read_data_from_file(const std::string& filename) {
-    std::ifstream fin(filename);
-    vector<vector<int64_t>> U_data(no_of_users, vector<int64_t>(no_of_features));
-    vector<vector<int64_t>> V_data(no_of_items, vector<int64_t>(no_of_features));
-
-    for (int i = 0; i < no_of_users; i++) {
-        for (int j = 0; j < no_of_features; j++) {
-            fin >> U_data[i][j];
-        }
-    }
-
-    for (int i = 0; i < no_of_items; i++) {
-        for (int j = 0; j < no_of_features; j++) {
-            fin >> V_data[i][j];
+// Print a matrix one row per line
+void print_matrix(MatrixView matrix) {
+    for (size_t i = 0; i < matrix.rows(); i++) {
+        for (int64_t val : matrix.row(i)) {
+            std::cout << val << " ";
         }
+        std::cout << "\n";
     }
-
-    fin.close();
-    return {U_data, V_data};
 }
 
 // Read queries from input file
 vector<pair<int,int>> read_queries(const std::string& filename) {
     std::ifstream fin(filename);
     vector<pair<int,int>> queries;
-    while(!fin.eof()){
-        int user_index,item_index;
-        fin>>user_index>>item_index;
+    int user_index,item_index;
+    while(fin>>user_index>>item_index){
         assert(user_index>=1 && user_index<=no_of_users);
         assert(item_index>=1 && item_index<=no_of_items);
         queries.emplace_back(user_index-1, item_index-1);
@@ -51,280 +41,274 @@ vector<pair<int,int>> read_queries(const std::string& filename) {
     return queries;
 }
 
-int main() {
-    try {
-        boost::asio::io_context io_context;
+// Give the parties their shares of e_j, either as dense vectors or as DPF keys
+void generate_item_selection(std::array<query_correlations, 2>& c, int item_index, const protocol_modes& modes) {
+    if (modes.item_selection == ITEM_SELECTION_DPF) {
+        vector<dpf_key_type> keys = generateDPF(no_of_items, item_index, 1);
+        c[0].item_key = serialize_dpf_key(keys[0]);
+        c[1].item_key = serialize_dpf_key(keys[1]);
+        return;
+    }
+    vector<vector<int64_t>> v_share = create_standard_basis_vec_shares(no_of_items, item_index);
+    c[0].item_share = std::move(v_share[0]);
+    c[1].item_share = std::move(v_share[1]);
+}
 
-        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), 9002));
+// Generate the inputs and correlated randomness of a single query for P0 and P1
+std::array<query_correlations, 2> generate_query_correlations(int user_index, int item_index, const protocol_modes& modes) {
+    std::array<query_correlations, 2> c;
 
-        // Accept clients
-        tcp::socket socket_p0(io_context);
-        acceptor.accept(socket_p0);
+    // For the k dot products between ith column of V and share of standared basis vector in order to obtain V_row
+    for (int b = 0; b < 2; b++) {
+        c[b].X = create_random_matrix(no_of_features, no_of_items, 1);
+        c[b].Y = create_random_matrix(no_of_features, no_of_items, 1);
+    }
+    for(int i=0;i<no_of_features;i++){
+        int64_t T = random_uint();
+        c[0].Z.push_back(share_ring::add(vector_dot_product(c[0].X.row(i), c[1].Y.row(i)), T));
+        c[1].Z.push_back(share_ring::sub(vector_dot_product(c[1].X.row(i), c[0].Y.row(i)), T));
+    }
 
-        tcp::socket socket_p1(io_context);
-        acceptor.accept(socket_p1);
+    // For the final dot product between U_row and V_row
+    c[0].X_uv = random_vector(no_of_features);
+    c[1].X_uv = random_vector(no_of_features);
+    c[0].Y_uv = random_vector(no_of_features);
+    c[1].Y_uv = random_vector(no_of_features);
+    int64_t T = random_uint();
+
+    c[0].Z_uv = share_ring::add(vector_dot_product(c[0].X_uv, c[1].Y_uv), T);
+    c[1].Z_uv = share_ring::sub(vector_dot_product(c[1].X_uv, c[0].Y_uv), T);
+
+    // For the k multiplications delta * V_row[i]
+    for (int i = 0; i < no_of_features; i++) {
+        int64_t deltaX0 = random_uint();
+        int64_t deltaY0 = random_uint();
+        int64_t deltaX1 = random_uint();
+        int64_t deltaY1 = random_uint();
+        int64_t alpha = random_uint();
+
+        c[0].deltaX.push_back(deltaX0);
+        c[0].deltaY.push_back(deltaY0);
+        c[0].deltaZ.push_back(share_ring::add(share_ring::mul(deltaX0, deltaY1), alpha));
+        c[1].deltaX.push_back(deltaX1);
+        c[1].deltaY.push_back(deltaY1);
+        c[1].deltaZ.push_back(share_ring::sub(share_ring::mul(deltaX1, deltaY0), alpha));
+    }
 
-        // create the user matrix U with dimensions m(# of users) x k(# of features)
-        std::vector<std::vector<std::vector<int64_t>>> file_data = read_data_from_file("inputs/initial_matrix.txt");
-        std::vector<std::vector<int64_t>> U = file_data[0];
-        std::vector<std::vector<int64_t>> U_0 = create_random_matrix(no_of_users, no_of_features,1);
-        std::vector<std::vector<int64_t>> U_1 = matrix_subtraction(U, U_0);
+    // user index is public, the item index is sent as shares of the standard basis vector
+    c[0].user_index = user_index;
+    c[1].user_index = user_index;
+    generate_item_selection(c, item_index, modes);
 
-        // create the item matrix V with dimensions n(# of items) x k(# of features)
-        std::vector<std::vector<int64_t>> V = file_data[1];
-        std::vector<std::vector<int64_t>> V_0 = create_random_matrix(no_of_items, no_of_features,1);
-        std::vector<std::vector<int64_t>> V_1 = matrix_subtraction(V, V_0);
+    c[0].share_of_1 = random_uint();
+    c[1].share_of_1 = share_ring::sub(1, c[0].share_of_1);
+    return c;
+}
 
-        // load queries from the file "queries.txt"
-        vector<pair<int,int>> queries = read_queries("inputs/queries.txt");
+// Generate the correlations of a single query in PREPROCESSING_SEEDED mode.
+// Both parties expand their masks from a seed, P2 expands the same seeds to compute
+// P1's Z values, share of 1 and share of e_j so that they match what P0 derives.
+std::array<query_correlations, 2> generate_seeded_query_correlations(int user_index, int item_index, const protocol_modes& modes) {
+    std::array<query_correlations, 2> c;
+    for (int b = 0; b < 2; b++) {
+        c[b].user_index = user_index;
+        c[b].seed = random_seed();
+        expand_query_correlations(c[b], b, modes);
+    }
 
-        vector<pair<int,vector<int64_t>>> u_v0share_pairs;
-        vector<pair<int,vector<int64_t>>> u_v1share_pairs;
+    // Z0 + Z1 = X0.Y1 + X1.Y0 for every Du Attalah instance
+    c[1].Z.resize(no_of_features);
+    for (int i = 0; i < no_of_features; i++) {
+        c[1].Z[i] = share_ring::sub(share_ring::add(vector_dot_product(c[0].X.row(i), c[1].Y.row(i)), vector_dot_product(c[1].X.row(i), c[0].Y.row(i))), c[0].Z[i]);
+    }
+    c[1].Z_uv = share_ring::sub(share_ring::add(vector_dot_product(c[0].X_uv, c[1].Y_uv), vector_dot_product(c[1].X_uv, c[0].Y_uv)), c[0].Z_uv);
 
-        // Each X0_set[i] = X0 for query i which is again a list of shares for doing k(# of features) dot products
-        // similar for other sets
-        vector<vector<vector<int64_t>>> X0_set, Y0_set, X1_set, Y1_set;
-        vector<vector<int64_t>> Z0_set, Z1_set;
+    c[1].deltaZ.resize(no_of_features);
+    for (int i = 0; i < no_of_features; i++) {
+        c[1].deltaZ[i] = share_ring::sub(share_ring::add(share_ring::mul(c[0].deltaX[i], c[1].deltaY[i]), share_ring::mul(c[1].deltaX[i], c[0].deltaY[i])), c[0].deltaZ[i]);
+    }
 
-        vector<vector<int64_t>> X0_uv, Y0_uv, X1_uv, Y1_uv;
-        vector<int64_t> Z0_uv, Z1_uv;
+    c[1].share_of_1 = share_ring::sub(1, c[0].share_of_1);
+    if (modes.item_selection == ITEM_SELECTION_DPF) {
+        generate_item_selection(c, item_index, modes);
+    } else {
+        c[1].item_share = SUB_vectors(standared_basis_vector(no_of_items, item_index), c[0].item_share);
+    }
 
-        vector<vector<int64_t>> delta_X0_set, delta_Y0_set, delta_X1_set, delta_Y1_set, delta_Z0_set, delta_Z1_set;
-        
-        // GENSHARES
-        // generate random shares for Du Attalah vector dot product protocol and multiplication protocol
-        for (const auto& [user_index, item_index]  : queries) {
-            
-            vector<vector<int64_t>> X0_store, Y0_store, X1_store, Y1_store;
-            vector<int64_t> Z0_store, Z1_store;
-            vector<int64_t> deltaX0_store, deltaY0_store, deltaX1_store, deltaY1_store;
-            vector<int64_t> deltaZ0_store, deltaZ1_store;
-
-            // For the k dot products between ith column of V and share of standared basis vector in order to obtain V_row
-            for(int i=0;i<no_of_features;i++){
-                vector<int64_t> X0 = random_vector(no_of_items);
-                vector<int64_t> X1 = random_vector(no_of_items);
-                vector<int64_t> Y0 = random_vector(no_of_items);
-                vector<int64_t> Y1 = random_vector(no_of_items);
-                int64_t T = random_uint();
-
-                int64_t Z0 = vector_dot_product(X0, Y1) + T;
-                int64_t Z1 = vector_dot_product(X1, Y0) - T;
-
-                X0_store.push_back(X0);
-                X1_store.push_back(X1);
-                Y0_store.push_back(Y0);
-                Y1_store.push_back(Y1);
-                Z0_store.push_back(Z0);
-                Z1_store.push_back(Z1);
-            }
+    // the parties expand the masks themselves, so only the seeds and P1's corrections are kept
+    strip_expandable_correlations(c[0], 0);
+    strip_expandable_correlations(c[1], 1);
+    return c;
+}
 
-            // For the final dot product between U_row and V_row
-            vector<int64_t> X0 = random_vector(no_of_features);
-            vector<int64_t> X1 = random_vector(no_of_features);
-            vector<int64_t> Y0 = random_vector(no_of_features);
-            vector<int64_t> Y1 = random_vector(no_of_features);
-            int64_t T = random_uint();
-
-            int64_t Z0 = vector_dot_product(X0, Y1) + T;
-            int64_t Z1 = vector_dot_product(X1, Y0) - T;
-
-            X0_uv.push_back(X0);
-            X1_uv.push_back(X1);
-            Y0_uv.push_back(Y0);
-            Y1_uv.push_back(Y1);
-            Z0_uv.push_back(Z0);
-            Z1_uv.push_back(Z1);
-
-            for (int i = 0; i < no_of_features; i++) {
-                int64_t deltaX0 = random_uint();
-                int64_t deltaY0 = random_uint();
-                int64_t deltaX1 = random_uint();
-                int64_t deltaY1 = random_uint();
-                int64_t alpha = random_uint();
-                
-                int64_t deltaZ0 = deltaX0 * deltaY1 + alpha;
-                int64_t deltaZ1 = deltaX1 * deltaY0 - alpha;
-                
-                deltaX0_store.push_back(deltaX0);
-                deltaY0_store.push_back(deltaY0);
-                deltaX1_store.push_back(deltaX1);
-                deltaY1_store.push_back(deltaY1);
-                deltaZ0_store.push_back(deltaZ0);
-                deltaZ1_store.push_back(deltaZ1);
-            }
+// Send the shares of U and V and the correlations of every query to a party,
+// then receive the party's share of the updated U matrix
+awaitable<void> serve_party(tcp::socket& sock,
+                            int party,
+                            MatrixView U_share,
+                            MatrixView V_share,
+                            int64_t num_queries,
+                            const protocol_modes& modes,
+                            bounded_queue<query_correlations>& queue,
+                            Matrix& U_out) {
+    co_await send_matrix(sock, U_share);
+    co_await send_matrix(sock, V_share);
+
+    // send # of queries and the protocol modes to the party
+    co_await send_coroutine(sock, num_queries);
+    co_await send_coroutine(sock, modes.preprocessing);
+    co_await send_coroutine(sock, modes.item_selection);
+
+    // the correlations are generated just in time by the dealer thread
+    for (int64_t i = 0; i < num_queries; i++) {
+        query_correlations c = co_await queue.pop();
+        co_await send_query_correlations(sock, c, modes, party);
+    }
 
-            // put in the set
-            X0_set.push_back(X0_store);
-            X1_set.push_back(X1_store);
-            Y0_set.push_back(Y0_store);
-            Y1_set.push_back(Y1_store);
-            Z0_set.push_back(Z0_store);
-            Z1_set.push_back(Z1_store);
+    // get the shares of updated U matrix from the party
+    U_out = co_await recv_matrix(sock);
+}
 
+/* take command line arguments [--seeded] [--dpf] [--input path] [--queries path]
+   [--users m] [--items n] [--features k] [--threads t] [--write-binary path] */
+int main(int argc, char* argv[]) {
+    protocol_modes modes;
+    std::string input_path = "inputs/initial_matrix.txt";
+    std::string queries_path = "inputs/queries.txt";
+    std::string binary_path;
+    matrix_dimensions requested;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--seeded") {
+            modes.preprocessing = PREPROCESSING_SEEDED;
+        } else if (arg == "--dpf") {
+            modes.item_selection = ITEM_SELECTION_DPF;
+        } else if (arg == "--input" && has_value) {
+            input_path = argv[++i];
+        } else if (arg == "--queries" && has_value) {
+            queries_path = argv[++i];
+        } else if (arg == "--users" && has_value) {
+            requested.users = std::atoll(argv[++i]);
+        } else if (arg == "--items" && has_value) {
+            requested.items = std::atoll(argv[++i]);
+        } else if (arg == "--features" && has_value) {
+            requested.features = std::atoll(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--write-binary" && has_value) {
+            binary_path = argv[++i];
+        } else {
+            std::cerr << "Usage: p2 [--seeded] [--dpf] [--input path] [--queries path] [--users m] [--items n] [--features k] [--threads t] [--write-binary path]" << std::endl
+                      << "--seeded: send PRG seeds and corrections instead of the full masks" << std::endl
+                      << "--dpf: send DPF keys instead of the shares of the standard basis vectors" << std::endl
+                      << "--input: text or binary file with U and V (default inputs/initial_matrix.txt)" << std::endl
+                      << "--queries: file with the queries (default inputs/queries.txt)" << std::endl
+                      << "--users, --items, --features: dimensions of a text input without a '# m n k' header" << std::endl
+                      << "--threads: threads parsing a text input (default: all cores)" << std::endl
+                      << "--write-binary: convert the input to the binary format that is memory mapped, then exit" << std::endl;
+            return 1;
+        }
+    }
 
-            delta_X0_set.push_back(deltaX0_store);
-            delta_X1_set.push_back(deltaX1_store);
-            delta_Y0_set.push_back(deltaY0_store);
-            delta_Y1_set.push_back(deltaY1_store);
-            delta_Z0_set.push_back(deltaZ0_store);
-            delta_Z1_set.push_back(deltaZ1_store);
+    try {
+        // Load U and V before waiting for the parties, so that the dimensions are known
+        auto input = std::make_unique<matrix_file>(input_path, requested, threads);
+        matrix_dimensions dims = input->dimensions();
+        no_of_users = dims.users;
+        no_of_items = dims.items;
+        no_of_features = dims.features;
+        if (!binary_path.empty()) {
+            write_matrix_file(binary_path, input->U(), input->V());
+            std::cout << "Wrote " << no_of_users << " x " << no_of_features << " U and " << no_of_items << " x " << no_of_features << " V to " << binary_path << "\n";
+            return 0;
+        }
 
+        boost::asio::io_context io_context;
 
-            vector<vector<int64_t>> v_share = create_standard_basis_vec_shares(no_of_items, item_index);
-            u_v0share_pairs.emplace_back(user_index, v_share[0]);
-            u_v1share_pairs.emplace_back(user_index, v_share[1]);
-        }
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), 9002));
 
-        vector<int64_t> share_of_1_P0 = random_vector(queries.size());
-        vector<int64_t> share_of_1_P1;
-        for(int i=0;i<queries.size();i++){
-            share_of_1_P1.push_back(1 - share_of_1_P0[i]);
+        // Accept clients, each of them first tells which party it is
+        tcp::socket socket_p0(io_context);
+        acceptor.accept(socket_p0);
+
+        tcp::socket socket_p1(io_context);
+        acceptor.accept(socket_p1);
+
+        int64_t first_party, second_party;
+        boost::asio::read(socket_p0, boost::asio::buffer(&first_party, sizeof(first_party)));
+        boost::asio::read(socket_p1, boost::asio::buffer(&second_party, sizeof(second_party)));
+        assert(first_party != second_party);
+        if (first_party == 1) {
+            std::swap(socket_p0, socket_p1);
         }
 
-        std::vector<std::vector<int64_t>> U_from_p0, U_from_p1;
+        // create the user matrix U with dimensions m(# of users) x k(# of features)
+        // The signed entries of the loaded (possibly memory mapped) U are reduced into share_ring,
+        // and U_1 = U - U_0 is computed in place in that copy, and likewise for V
+        Matrix U_0 = create_random_matrix(no_of_users, no_of_features,1);
+        Matrix U_1 = matrix_subtraction(matrix_from_signed(input->U()), U_0);
+
+        // create the item matrix V with dimensions n(# of items) x k(# of features)
+        Matrix V_0 = create_random_matrix(no_of_items, no_of_features,1);
+        Matrix V_1 = matrix_subtraction(matrix_from_signed(input->V()), V_0);
+        input.reset();
+
+        // load the queries
+        vector<pair<int,int>> queries = read_queries(queries_path);
+        int64_t num_queries = queries.size();
+
+        // GENSHARES
+        // The dealer thread generates the random shares for the Du Attalah protocols of each
+        // query just in time. The queues are bounded, so the dealer blocks once it is
+        // DEALER_QUEUE_CAPACITY queries ahead of the slower socket, and the memory used for
+        // the correlations does not grow with the number of queries.
+        bounded_queue<query_correlations> queue_p0(io_context.get_executor(), DEALER_QUEUE_CAPACITY);
+        bounded_queue<query_correlations> queue_p1(io_context.get_executor(), DEALER_QUEUE_CAPACITY);
+        std::thread dealer([&]() {
+            for (const auto& [user_index, item_index] : queries) {
+                std::array<query_correlations, 2> c = modes.preprocessing == PREPROCESSING_SEEDED
+                    ? generate_seeded_query_correlations(user_index, item_index, modes)
+                    : generate_query_correlations(user_index, item_index, modes);
+                if (!queue_p0.push(std::move(c[0])) || !queue_p1.push(std::move(c[1]))) {
+                    return;
+                }
+            }
+        });
+
+        Matrix U_from_p0, U_from_p1;
 
         run_in_parallel(io_context,
             [&]() -> boost::asio::awaitable<void> {
-                // send the matrix U_0 and V_0 to P0
-                co_await send_matrix(socket_p0, U_0);
-                co_await send_matrix(socket_p0, V_0);
-
-                // send # of queries to P0
-                int64_t num_queries = queries.size();
-                co_await boost::asio::async_write(socket_p0, boost::asio::buffer(&num_queries, sizeof(num_queries)), use_awaitable);
-
-                // send the user index and item share vector to P0
-                for (int i=0;i<queries.size();i++) {
-
-                    const auto& [user_index, item_share]  = u_v0share_pairs[i];
-
-                    const auto& X0 = X0_set[i];
-                    const auto& Y0 = Y0_set[i];
-                    const auto& Z0 = Z0_set[i];
-
-                    const auto& X0_uv_i = X0_uv[i];
-                    const auto& Y0_uv_i = Y0_uv[i];
-                    const auto& Z0_uv_i = Z0_uv[i];
-                    
-
-                    const auto& deltaX0 = delta_X0_set[i];
-                    const auto& deltaY0 = delta_Y0_set[i];
-                    const auto& deltaZ0 = delta_Z0_set[i];
-
-                    // Send user index to p0 because it is public
-                    int64_t u_idx = user_index;
-                    co_await boost::asio::async_write(socket_p0, boost::asio::buffer(&u_idx, sizeof(u_idx)), use_awaitable);
-                    // Send item share vector to p0
-                    co_await send_vector(socket_p0, item_share);
-                    
-                    // Send random vector shares for Du Attalah vector dot product protocol
-                    co_await send_matrix(socket_p0, X0);
-                    co_await send_matrix(socket_p0, Y0);
-                    co_await send_vector(socket_p0, Z0);
-                    
-                    co_await send_vector(socket_p0, X0_uv_i);
-                    co_await send_vector(socket_p0, Y0_uv_i);
-                    co_await boost::asio::async_write(socket_p0, boost::asio::buffer(&Z0_uv_i, sizeof(Z0_uv_i)), use_awaitable);
-
-
-                    // Send delta shares for Du Attalah multiplication protocol
-                    co_await send_vector(socket_p0, deltaX0);
-                    co_await send_vector(socket_p0, deltaY0);
-                    co_await send_vector(socket_p0, deltaZ0);
-
-                    // send share of 1 to P0
-                    co_await boost::asio::async_write(socket_p0, boost::asio::buffer(&share_of_1_P0[i], sizeof(share_of_1_P0[i])), use_awaitable);
-                }
-                // get the shares of updated U matrix from P0
-                U_from_p0 = co_await recv_matrix(socket_p0);
+                co_await serve_party(socket_p0, 0, U_0, V_0, num_queries, modes, queue_p0, U_from_p0);
             },
             [&]() -> boost::asio::awaitable<void> {
-                // send the matrix U_1 and V_1 to P1
-                co_await send_matrix(socket_p1, U_1);
-                co_await send_matrix(socket_p1, V_1);
-
-                // send # of queries to P1
-                int64_t num_queries = queries.size();
-                co_await boost::asio::async_write(socket_p1, boost::asio::buffer(&num_queries, sizeof(num_queries)), use_awaitable);
-
-                // send the user index and item share vector to P1
-                for (int i=0;i<queries.size();i++) {
-
-                    const auto& [user_index, item_share]  = u_v1share_pairs[i];
-
-                    const auto& X1 = X1_set[i];
-                    const auto& Y1 = Y1_set[i];
-                    const auto& Z1 = Z1_set[i];
-
-                    const auto& X1_uv_i = X1_uv[i];
-                    const auto& Y1_uv_i = Y1_uv[i];
-                    const auto& Z1_uv_i = Z1_uv[i];
-
-                    const auto& deltaX1 = delta_X1_set[i];
-                    const auto& deltaY1 = delta_Y1_set[i];
-                    const auto& deltaZ1 = delta_Z1_set[i];
-                    
-
-                    int64_t u_idx = user_index;
-                    co_await boost::asio::async_write(socket_p1, boost::asio::buffer(&u_idx, sizeof(u_idx)), use_awaitable);
-                    co_await send_vector(socket_p1, item_share);
-
-                    // Send random vector shares for Du Attalah vector dot product protocol
-                    co_await send_matrix(socket_p1, X1);
-                    co_await send_matrix(socket_p1, Y1);
-                    co_await send_vector(socket_p1, Z1);
-
-                    
-                    co_await send_vector(socket_p1, X1_uv_i);
-                    co_await send_vector(socket_p1, Y1_uv_i);
-                    co_await boost::asio::async_write(socket_p1, boost::asio::buffer(&Z1_uv_i, sizeof(Z1_uv_i)), use_awaitable);
-                    
-                    // send random multiplication shares for Du Attalah multiplication protocol
-                    co_await send_vector(socket_p1, deltaX1);
-                    co_await send_vector(socket_p1, deltaY1);
-                    co_await send_vector(socket_p1, deltaZ1);
-
-                    // send share of 1 to P1
-                    co_await boost::asio::async_write(socket_p1, boost::asio::buffer(&share_of_1_P1[i], sizeof(share_of_1_P1[i])), use_awaitable);
-                }
-                // get the shares of updated U matrix from P1
-                U_from_p1 = co_await recv_matrix(socket_p1);
+                co_await serve_party(socket_p1, 1, U_1, V_1, num_queries, modes, queue_p1, U_from_p1);
             }
         );
 
         io_context.run();
+        queue_p0.close();
+        queue_p1.close();
+        dealer.join();
 
         // Print the final U matrix from both the parties
         std::cout << "\nFinal share of U matrix from P0:\n";
-        for (const auto& row : U_from_p0) {
-            for (const auto& val : row) {
-                std::cout << val << " ";
-            }
-            std::cout << "\n";
-        }
+        print_matrix(U_from_p0);
         std::cout << "\n\nFinal share of U matrix from P1:\n";
-        for (const auto& row : U_from_p1) {
-            for (const auto& val : row) {
-                std::cout << val << " ";
-            }
-            std::cout << "\n";
-        }
+        print_matrix(U_from_p1);
         
         // Add the shares of the updated U matrix received from P0 and P1
-        std::vector<std::vector<int64_t>> U_final = matrix_addition(U_from_p0, U_from_p1);
+        Matrix U_final = matrix_addition(std::move(U_from_p0), U_from_p1);
 
         // Print the final U matrix
         std::cout << "\nFinal U matrix after adding both the shares:\n";
-        for (const auto& row : U_final) {
-            for (const auto& val : row) {
-                std::cout << val << " ";
-            }
-            std::cout << "\n";
-        }
+        print_matrix(U_final);
         std::cout << "Adios from P2. ;)\n";
 
     } catch (std::exception& e) {
         std::cerr << "Exception in P2: " << e.what() << "\n";
+        return 1;
     }
 }
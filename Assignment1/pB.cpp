@@ -1,119 +1,162 @@
 #include "header_files/common.hpp"
 #include "header_files/matrix_operations.hpp"
+#include "header_files/correlations.hpp"
+#include "header_files/peer_channel.hpp"
 
 #if !defined(ROLE_p0) && !defined(ROLE_p1)
 #error "ROLE must be defined as ROLE_p0 or ROLE_p1"
 #endif
 
+#ifdef ROLE_p0
+const int PARTY = 0;
+#else
+const int PARTY = 1;
+#endif
+
 
-// Function to perform a single query (not used in current code)
+// Function to perform a single query
+// The peer is the channel of this query, so that many queries can run concurrently
+// K is the number of features, fixed at compile time or dynamic_extent (see select_query_engine)
+template <size_t K, typename Peer>
 awaitable<vector<int64_t>> perform_query(
-                        std::vector<std::vector<int64_t>>& U_share,
-                        std::vector<std::vector<int64_t>>& V_share,
-                        int64_t user_index,
-                        const std::vector<int64_t>& item_share,
-                        const std::vector<vector<int64_t>>& X,
-                        const std::vector<vector<int64_t>>& Y,
-                        const std::vector<int64_t>& Z,
-                        const std::vector<int64_t>& X_uv,
-                        const std::vector<int64_t>& Y_uv,
-                        int64_t Z_uv,
-                        const std::vector<int64_t>& deltaX,
-                        const std::vector<int64_t>& deltaY,
-                        const std::vector<int64_t>& deltaZ,
-                        tcp::socket& peer_socket,
-                        tcp::socket& server_socket
+                        Matrix& U_share,
+                        MatrixView V_columns,
+                        const query_correlations& c,
+                        Peer& peer_socket
                     ) {
-    int k = no_of_features;
-    std::vector<int64_t> U_row = U_share[user_index];
+    size_t k = no_of_features;
+    int64_t user_index = c.user_index;
+    // Queries on the same user never overlap, so the row is read and updated in place
+    span<int64_t, K> U_row = feature_span<K>(U_share.row(user_index));
     assert(U_row.size() == k);
 
-    assert(X.size() == k);
-    assert(Y.size() == k);
-    assert(Z.size() == k);
-
+    assert(c.X.rows() == k);
+    assert(c.Y.rows() == k);
+    assert(c.Z.size() == k);
 
-    std::vector<int64_t> V_row;
-    for(int i=0;i<k;i++){
-        vector<int64_t> col = fetch_column_from_matrix(V_share, i);
-        assert(col.size() == item_share.size());
-
-        int64_t dot_product = co_await mpc_dot_product(col, item_share, X[i], Y[i], Z[i], peer_socket);
-        V_row.push_back(dot_product);
-    }
-
-    assert(V_row.size() == k);
+    // The i-th component of V_row is the dot product of the i-th column of V with e_j,
+    // so all k components are computed together in a single round. V is kept column-major,
+    // so the columns are read in place.
+    assert(V_columns.rows() == k && V_columns.cols() == c.item_share.size());
+    const std::vector<int64_t> V_row_values = co_await mpc_matrix_vector_product(V_columns, c.item_share, c.X, c.Y, c.Z, peer_socket);
+    span<const int64_t, K> V_row = feature_span<K>(V_row_values);
 
     assert(U_row.size() == k);
     assert(V_row.size() == k);
-    assert(X_uv.size() == k);
-    assert(Y_uv.size() == k);
+    assert(c.X_uv.size() == k);
+    assert(c.Y_uv.size() == k);
 
-    int64_t U_row_dot_V_row_share = co_await mpc_dot_product(U_row, V_row, X_uv, Y_uv, Z_uv, peer_socket);
+    int64_t U_row_dot_V_row_share = co_await mpc_dot_product<K>(U_row, V_row, feature_span<K>(c.X_uv), feature_span<K>(c.Y_uv), c.Z_uv, peer_socket);
 
-    // recieve share of 1 from p2
-    int64_t share_of_1;
-    co_await recv_coroutine(server_socket, share_of_1);
+    int64_t delta = (int64_t)share_ring::sub(c.share_of_1, U_row_dot_V_row_share);
 
-    int64_t delta = share_of_1 - U_row_dot_V_row_share;
+    // All k products delta * V_row[i] are computed in a single round
+    feature_row<K> V_row_mult_delta = co_await mpc_vector_scalar_multiplication<K>(V_row, delta, feature_span<K>(c.deltaX), feature_span<K>(c.deltaY), feature_span<K>(c.deltaZ), peer_socket);
 
-    vector<int64_t> V_row_mult_delta;
-    for (int i = 0; i < k; i++) {
-        V_row_mult_delta.push_back(co_await mpc_multiplication(V_row[i], delta, deltaX[i], deltaY[i], deltaZ[i], peer_socket));
-    }
+    feature_add_inplace<K>(U_row, V_row_mult_delta);
+    co_return vector<int64_t>(U_row.begin(), U_row.end());
+}
 
-    // cout << "V_row multiplied by delta: ";
-    // for (const auto& val : V_row_mult_delta) {
-    //     cout << val << " ";
-    // }
-    // cout << endl;
-    // assert(V_row_mult_delta.size() == k);
-    // cout << U_row.size() << " " << V_row_mult_delta.size() << endl;
-    vector<int64_t> result = vector_addition(V_row_mult_delta, U_row);
-    for (int i = 0; i < result.size(); i++) {
-        U_share[user_index][i] = result[i];
+// perform_query instantiated for a number of features
+using query_engine = awaitable<vector<int64_t>> (*)(Matrix&, MatrixView, const query_correlations&, query_channel&);
+
+// Picks the instantiation of perform_query once, before the first query. The usual embedding
+// sizes get an engine whose k-length loops are fully unrolled, any other k the generic one.
+// Compile with -DDYNAMIC_FEATURES_ONLY to always use the generic engine.
+query_engine select_query_engine(int k) {
+#ifndef DYNAMIC_FEATURES_ONLY
+    switch (k) {
+        case 8: return perform_query<8, query_channel>;
+        case 16: return perform_query<16, query_channel>;
+        case 32: return perform_query<32, query_channel>;
+        case 64: return perform_query<64, query_channel>;
     }
-    assert(result.size() == k);
-    co_return result;
+#endif
+    return perform_query<dynamic_extent, query_channel>;
 }
 
+// State of a query that has been scheduled, later queries on the same user wait for it
+struct scheduled_query {
+    bool done = false;
+    std::unique_ptr<async_condition> finished;
+};
+
 // ----------------------- Main protocol -----------------------
 awaitable<void> run(boost::asio::io_context& io_context) {
     tcp::resolver resolver(io_context);
+    auto executor = co_await this_coro::executor;
 
     // Step 1: connect to P2 and receive random value
     tcp::socket server_sock = co_await setup_server_connection(io_context, resolver);
 
-    std::vector<std::vector<int64_t>> U = co_await recv_matrix(server_sock);
-    std::vector<std::vector<int64_t>> V = co_await recv_matrix(server_sock);
+    Matrix U = co_await recv_matrix(server_sock);
+    // V is only read, one column per feature, so it is stored column-major once here
+    Matrix V_columns = co_await recv_matrix_transposed(server_sock);
+    no_of_users = U.rows();
+    no_of_features = U.cols();
+    no_of_items = V_columns.cols();
+    query_engine engine = select_query_engine(no_of_features);
 
-    int64_t num_queries;
+    int64_t num_queries, preprocessing, item_selection;
     co_await recv_coroutine(server_sock, num_queries);
+    co_await recv_coroutine(server_sock, preprocessing);
+    co_await recv_coroutine(server_sock, item_selection);
+    protocol_modes modes{(preprocessing_mode)preprocessing, (item_selection_mode)item_selection};
     
     tcp::socket peer_sock = co_await setup_peer_connection(io_context, resolver);
+    peer_channel channel(peer_sock);
+    channel.start();
 
-    for (int64_t q = 0; q < num_queries; ++q) {
-        int64_t user_index;
-        co_await recv_coroutine(server_sock, user_index);
-        std::vector<int64_t> item_share = co_await recv_vector(server_sock);
-
-        std::vector<vector<int64_t>> X = co_await recv_matrix(server_sock);
-        std::vector<vector<int64_t>> Y = co_await recv_matrix(server_sock);
-        std::vector<int64_t> Z = co_await recv_vector(server_sock);
-
-        std::vector<int64_t> X_uv = co_await recv_vector(server_sock);
-        std::vector<int64_t> Y_uv = co_await recv_vector(server_sock);
-        int64_t Z_uv;
-        co_await recv_coroutine(server_sock, Z_uv);
-
-        std::vector<int64_t> deltaX, deltaY, deltaZ;
-        deltaX = co_await recv_vector(server_sock);
-        deltaY = co_await recv_vector(server_sock);
-        deltaZ = co_await recv_vector(server_sock);
+    // Queries on different users touch disjoint rows of U, so up to MAX_QUERIES_IN_FLIGHT
+    // of them run concurrently, each exchanging messages tagged with its query id.
+    // A query on a user that already has a query in flight waits for that one to finish,
+    // so the updates of a single row are applied in the order of the queries.
+    std::map<int64_t, std::shared_ptr<scheduled_query>> last_query_of_user;
+    int64_t in_flight = 0;
+    async_condition query_finished(executor);
 
+    for (int64_t q = 0; q < num_queries; ++q) {
+        while (in_flight >= MAX_QUERIES_IN_FLIGHT) {
+            co_await query_finished.wait();
+        }
+
+        auto c = std::make_shared<query_correlations>(co_await recv_query_correlations(server_sock, modes, PARTY));
+
+        auto current = std::make_shared<scheduled_query>();
+        current->finished = std::make_unique<async_condition>(executor);
+        std::shared_ptr<scheduled_query> previous;
+        auto it = last_query_of_user.find(c->user_index);
+        if (it != last_query_of_user.end()) {
+            previous = it->second;
+        }
+        last_query_of_user[c->user_index] = current;
+        in_flight++;
+
+        co_spawn(executor,
+            [&, engine, q, c, current, previous]() -> awaitable<void> {
+                while (previous && !previous->done) {
+                    co_await previous->finished->wait();
+                }
+                query_channel peer{channel, q};
+                co_await engine(U, V_columns, *c, peer);
+
+                current->done = true;
+                current->finished->notify_all();
+                if (last_query_of_user[c->user_index] == current) {
+                    last_query_of_user.erase(c->user_index);
+                }
+                in_flight--;
+                query_finished.notify_all();
+            },
+            [](std::exception_ptr e) {
+                if (e) std::rethrow_exception(e);
+            });
+    }
 
-        co_await perform_query(U, V, user_index, item_share, X, Y, Z, X_uv, Y_uv, Z_uv, deltaX, deltaY, deltaZ, peer_sock, server_sock);
+    while (in_flight > 0) {
+        co_await query_finished.wait();
     }
+    co_await channel.close();
 
     co_await send_matrix(server_sock, U);
     co_return;
@@ -0,0 +1,300 @@
+#include "header_files/common.hpp"
+#include "header_files/matrix_operations.hpp"
+#include "header_files/dpf.hpp"
+
+/*
+Self-checks of the arithmetic and the Du-Atallah protocols used by P0, P1 and P2, run with
+    g++ -std=c++20 -O2 -pthread self_check.cpp -o self_check -lboost_system && ./self_check
+Every check compares against a straightforward 128-bit reference and prints a verdict.
+*/
+
+const size_t KERNEL_CHECK_LENGTHS[] = {0, 1, 3, 4, 7, 8, 9, 15, 16, 17, 31, 33, 64, 100, 1000};
+const int KERNEL_CHECK_ROUNDS = 20;
+const int PROTOCOL_CHECK_ROUNDS = 20;
+
+const char* simd_level_name(simd_level level) {
+    switch (level) {
+        case SIMD_AVX512: return "AVX-512";
+        case SIMD_AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+// Random ring word, with the extreme values of the range drawn more often
+uint64_t random_word(mt19937_64& gen, uint64_t max_value) {
+    switch (gen() % 8) {
+        case 0: return 0;
+        case 1: return max_value;
+        case 2: return max_value - gen() % 4;
+        default: return max_value == UINT64_MAX ? gen() : gen() % (max_value + 1);
+    }
+}
+
+/*
+Checks the dot product and axpy kernels of both rings at the current SIMD_LEVEL.
+The Mersenne-61 inputs are in [0, p] as the kernels allow, the outputs must be in [0, p).
+*/
+bool check_kernels(mt19937_64& gen) {
+    for (int round = 0; round < KERNEL_CHECK_ROUNDS; round++) {
+        for (size_t n : KERNEL_CHECK_LENGTHS) {
+            for (bool mersenne : {false, true}) {
+                uint64_t max_value = mersenne ? MERSENNE_61 : UINT64_MAX;
+                vector<uint64_t> a(n), b(n), y(n);
+                for (size_t i = 0; i < n; i++) {
+                    a[i] = random_word(gen, max_value);
+                    b[i] = random_word(gen, max_value);
+                    y[i] = random_word(gen, max_value);
+                }
+                uint64_t alpha = random_word(gen, max_value);
+
+                unsigned __int128 expected_dot = 0;
+                vector<uint64_t> expected_y(n);
+                for (size_t i = 0; i < n; i++) {
+                    unsigned __int128 product = (unsigned __int128)a[i] * b[i];
+                    unsigned __int128 update = y[i] + (unsigned __int128)alpha * a[i];
+                    if (mersenne) {
+                        expected_dot = (expected_dot + product % MERSENNE_61) % MERSENNE_61;
+                        expected_y[i] = (uint64_t)(update % MERSENNE_61);
+                    } else {
+                        expected_dot += product;
+                        expected_y[i] = (uint64_t)update;
+                    }
+                }
+
+                uint64_t dot = mersenne ? dot_product_mersenne61(a.data(), b.data(), n) : dot_product_ring64(a.data(), b.data(), n);
+                if (dot != (uint64_t)expected_dot) {
+                    return false;
+                }
+                if (mersenne) {
+                    axpy_mersenne61(alpha, a.data(), y.data(), n);
+                } else {
+                    axpy_ring64(alpha, a.data(), y.data(), n);
+                }
+                if (y != expected_y) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+Both parties of a Du-Atallah helper run as coroutines on one io_context and exchange their
+messages through a local_link instead of a socket, party b receives from inbox[b].
+*/
+struct local_link {
+    explicit local_link(boost::asio::any_io_executor executor) : ready(executor) {}
+
+    async_condition ready;
+    deque<vector<int64_t>> inbox[2];
+};
+
+struct local_peer {
+    local_link& link;
+    int party;
+};
+
+awaitable<std::vector<int64_t>> exchange_vector(local_peer& peer, const std::vector<int64_t>& vec) {
+    peer.link.inbox[1 - peer.party].push_back(vec);
+    peer.link.ready.notify_all();
+    while (peer.link.inbox[peer.party].empty()) {
+        co_await peer.link.ready.wait();
+    }
+    vector<int64_t> message = std::move(peer.link.inbox[peer.party].front());
+    peer.link.inbox[peer.party].pop_front();
+    co_return message;
+}
+
+// Runs party(b, peer) for b = 0, 1 against each other and returns their outputs
+template <typename T, typename F>
+array<T, 2> run_two_parties(F party) {
+    boost::asio::io_context io_context;
+    local_link link(io_context.get_executor());
+    local_peer peers[2] = {{link, 0}, {link, 1}};
+    array<T, 2> outputs;
+    for (int b = 0; b < 2; b++) {
+        co_spawn(io_context, [&, b]() -> awaitable<void> { outputs[b] = co_await party(b, peers[b]); }, detached);
+    }
+    io_context.run();
+    return outputs;
+}
+
+// Random signed value, negative ones exercise R::from_signed
+int64_t random_signed(mt19937_64& gen) {
+    return gen() % 2 ? (int64_t)gen() : (int64_t)(gen() % 2001) - 1000;
+}
+
+// The element that two additive shares reconstruct to
+template <typename R>
+R reconstruct(int64_t share0, int64_t share1) {
+    return R::from_word(share0) + R::from_word(share1);
+}
+
+// Additive shares in R of the signed values
+template <typename R>
+array<vector<int64_t>, 2> share_values(span<const int64_t> values) {
+    vector<int64_t> share0 = random_vector<R>(values.size());
+    vector<int64_t> share1(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        share1[i] = (R(values[i]) - R::from_word(share0[i])).share();
+    }
+    return {std::move(share0), std::move(share1)};
+}
+
+/*
+Checks the Du-Atallah helpers of matrix_operations.hpp in the ring R: the dot product (with a
+dynamic and a fixed number of features K), the matrix-vector product and the vector-scalar
+product. The parties get masks from the dealer as P2 makes them, and the reconstructed outputs
+are compared with the same computation on plain Ring values. Also checks that the shares of a
+standard basis vector from P2 and from a DPF reconstruct to e_j.
+*/
+template <typename R, size_t K>
+bool check_protocols(mt19937_64& gen) {
+    using feature = span<const int64_t, K>;
+    const size_t k = K == dynamic_extent ? 1 + gen() % 12 : K;
+    const size_t n = 1 + gen() % 40;
+
+    vector<int64_t> a(k), b(k);
+    for (size_t i = 0; i < k; i++) {
+        a[i] = random_signed(gen);
+        b[i] = random_signed(gen);
+    }
+    int64_t x = random_signed(gen);
+    array<vector<int64_t>, 2> a_shares = share_values<R>(a), b_shares = share_values<R>(b);
+    array<vector<int64_t>, 2> x_shares = share_values<R>(vector<int64_t>{x});
+
+    // Du-Atallah masks of k products: Z0 + Z1 = X0 * Y1 + X1 * Y0
+    array<vector<int64_t>, 2> X, Y, Z;
+    for (int p = 0; p < 2; p++) {
+        X[p] = random_vector<R>(k);
+        Y[p] = random_vector<R>(k);
+    }
+    Z[0] = random_vector<R>(k);
+    Z[1].resize(k);
+    for (size_t i = 0; i < k; i++) {
+        R cross = R::from_word(X[0][i]) * R::from_word(Y[1][i]) + R::from_word(X[1][i]) * R::from_word(Y[0][i]);
+        Z[1][i] = (cross - R::from_word(Z[0][i])).share();
+    }
+    // and of one dot product: Z0 + Z1 = <X0, Y1> + <X1, Y0>
+    int64_t Z_dot[2];
+    Z_dot[0] = random_uint<R>();
+    R cross_dot(0);
+    for (size_t i = 0; i < k; i++) {
+        cross_dot += R::from_word(Z[0][i]) + R::from_word(Z[1][i]);
+    }
+    Z_dot[1] = (cross_dot - R::from_word(Z_dot[0])).share();
+
+    R expected_dot(0);
+    for (size_t i = 0; i < k; i++) {
+        expected_dot += R(a[i]) * R(b[i]);
+    }
+    array<int64_t, 2> dot = run_two_parties<int64_t>([&](int p, local_peer& peer) {
+        return mpc_dot_product<K, R>(feature(a_shares[p].data(), k), feature(b_shares[p].data(), k), feature(X[p].data(), k), feature(Y[p].data(), k), Z_dot[p], peer);
+    });
+    if (reconstruct<R>(dot[0], dot[1]) != expected_dot) {
+        return false;
+    }
+
+    array<feature_row<K>, 2> scaled = run_two_parties<feature_row<K>>([&](int p, local_peer& peer) {
+        return mpc_vector_scalar_multiplication<K, R>(feature(a_shares[p].data(), k), x_shares[p][0], feature(X[p].data(), k), feature(Y[p].data(), k), feature(Z[p].data(), k), peer);
+    });
+    for (size_t i = 0; i < k; i++) {
+        if (reconstruct<R>(scaled[0][i], scaled[1][i]) != R(a[i]) * R(x)) {
+            return false;
+        }
+    }
+
+    // k x n matrix times a length n vector, with the shares of e_j as the vector like in a query
+    Matrix V(k, n);
+    for (size_t i = 0; i < V.size(); i++) {
+        V.data()[i] = random_signed(gen);
+    }
+    size_t j = gen() % n;
+    array<Matrix, 2> V_shares;
+    V_shares[0] = create_random_matrix<R>(k, n, 1);
+    V_shares[1] = matrix_subtraction<R>(matrix_from_signed<R>(V), V_shares[0]);
+    vector<vector<int64_t>> e_shares = create_standard_basis_vec_shares<R>(n, j);
+    array<Matrix, 2> MX, MY;
+    array<vector<int64_t>, 2> MZ;
+    for (int p = 0; p < 2; p++) {
+        MX[p] = create_random_matrix<R>(k, n, 1);
+        MY[p] = create_random_matrix<R>(k, n, 1);
+    }
+    for (size_t i = 0; i < k; i++) {
+        int64_t T = random_uint<R>();
+        MZ[0].push_back(R::add(vector_dot_product<R>(MX[0].row(i), MY[1].row(i)), T));
+        MZ[1].push_back(R::sub(vector_dot_product<R>(MX[1].row(i), MY[0].row(i)), T));
+    }
+    array<vector<int64_t>, 2> column = run_two_parties<vector<int64_t>>([&](int p, local_peer& peer) {
+        return mpc_matrix_vector_product<R>(V_shares[p], e_shares[p], MX[p], MY[p], MZ[p], peer);
+    });
+    for (size_t i = 0; i < k; i++) {
+        if (reconstruct<R>(column[0][i], column[1][i]) != R(V(i, j))) {
+            return false;
+        }
+    }
+
+    // The DPF outputs are shares of e_j too
+    vector<dpf_key_type> keys = generateDPF<R>(n, j, 1);
+    vector<int64_t> dpf_shares[2] = {EvalFull<R>(n, keys[0]), EvalFull<R>(n, keys[1])};
+    for (size_t i = 0; i < n; i++) {
+        if (reconstruct<R>(dpf_shares[0][i], dpf_shares[1][i]) != R(i == j)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Checks that seeded_prg draws the words of the AES stream expand_seed(seed) in Z_2^64, that the
+same seed always gives the same masks, and that the Mersenne-61 masks are ring elements.
+*/
+bool check_seeded_prg(mt19937_64& gen) {
+    const size_t WORDS = 1000;
+    int64_t seed = gen();
+    vector<int64_t> stream(WORDS);
+    expand_seed(seed, stream.data(), WORDS);
+    if (seeded_prg<Ring<modulus_2_64>>(seed).next_vector(WORDS) != stream) {
+        return false;
+    }
+    seeded_prg<Ring<mersenne_modulus<61>>> prg1(seed), prg2(seed);
+    vector<int64_t> masks = prg1.next_vector(WORDS);
+    return masks == prg2.next_vector(WORDS) && all_of(masks.begin(), masks.end(), [](int64_t mask) { return (uint64_t)mask < MERSENNE_61; });
+}
+
+template <typename R>
+bool check_ring(mt19937_64& gen, const char* name) {
+    bool flag = true;
+    for (int round = 0; round < PROTOCOL_CHECK_ROUNDS; round++) {
+        flag = flag && check_protocols<R, dynamic_extent>(gen) && check_protocols<R, 8>(gen);
+    }
+    cout << "Final Verdict for the Du-Atallah helpers over " << name << ": " << (flag ? "PASSED" : "FAILED") << endl;
+    return flag;
+}
+
+int main() {
+    mt19937_64 gen(random_device{}());
+    bool all_passed = true;
+
+    // Every SIMD level the processor supports must give the same, exact, results
+    simd_level detected = SIMD_LEVEL;
+    for (int level = SIMD_SCALAR; level <= detected; level++) {
+        SIMD_LEVEL = (simd_level)level;
+        bool flag = check_kernels(gen);
+        all_passed = all_passed && flag;
+        cout << "Final Verdict for " << simd_level_name(SIMD_LEVEL) << " kernels: " << (flag ? "PASSED" : "FAILED") << endl;
+    }
+    SIMD_LEVEL = detected;
+
+    bool prg_flag = check_seeded_prg(gen);
+    all_passed = all_passed && prg_flag;
+    cout << "Final Verdict for the seeded masks: " << (prg_flag ? "PASSED" : "FAILED") << endl;
+
+    // The protocols must be correct in every ring the shares can live in
+    all_passed = check_ring<Ring<modulus_2_64>>(gen, "Z_2^64") && all_passed;
+    all_passed = check_ring<Ring<mersenne_modulus<61>>>(gen, "Z_(2^61 - 1)") && all_passed;
+    all_passed = check_ring<Ring<prime_modulus<1000000007>>>(gen, "Z_1000000007") && all_passed;
+
+    return all_passed ? 0 : 1;
+}
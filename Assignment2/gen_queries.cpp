@@ -1,338 +1,315 @@
 #include <bits/stdc++.h>
+#include "header_files/dpf.hpp"
 using namespace std;
 
-int64_t PRIME = 2305843009213693951; // 2^61 - 1
 int64_t ALPHA = 696969; // range of "target_value"
-
-/* 
-A structure to hold a DPF key.
-- root: The root seed of the DPF tree.
-- flag: The flag associated with the root seed.
-- cw: A vector of correction words for each layer of the DPF tree.
-- fcw0: A vector of flag correction words for all nodes not in the path to target node in a layer.
-- fcw1: A vector of flag correction words for the node in the path to target node in a layer.
-*/
-struct dpf_key_type {
-    int64_t root;
-    uint8_t flag;
-    vector<int64_t> cw;
-    vector<uint8_t> fcw0;
-    vector<uint8_t> fcw1;
-    int64_t final_cw;
-};
+uint64_t FULL_CHECK_LIMIT = uint64_t(1) << 24; // larger domains are checked at sampled indices
+uint64_t RANGE_CHECK_WIDTH = 3000; // indices on each side of the target checked with EvalRange
+int ARITHMETIC_PAYLOAD_LENGTH = 3; // length of the payload of the arithmetic DPFs checked by main
 
 /*
-A function to generate a random 64-bit integer in the range [1, PRIME).
-With the seed provided as argument it initializes the random number generator with that seed.
+A function that checks the correctness of the generated DPF keys by evaluating them and verifying the output.
+Domains larger than FULL_CHECK_LIMIT are never materialized: the keys are then checked at the target,
+its neighbours, a sorted random sample of indices and with EvalRange on a window around the target.
 */
-inline int64_t random_uint(int seed=0) {
-    static std::random_device rd;
-    static std::mt19937_64 gen(rd());
-    if(seed != 0) {
-        gen.seed(seed);
+bool check_dpf_correctness(uint64_t domain_size, uint64_t target_index, int64_t target_value, vector<dpf_key_type> dpf_keys, thread_pool& pool) {
+    // The point evaluations must agree at the target
+    if((Eval(dpf_keys[0], target_index) ^ Eval(dpf_keys[1], target_index)) != target_value) {
+        return false;
     }
-    static std::uniform_int_distribution<int64_t> dis(1, PRIME);
-    return dis(gen);
-}
-
-/*
-Given a 64bit random number(say 's') it generates two 64bit random number using 's' as the seed.
-It returns a vector of size 2 containing the two generated random numbers.
-*/
-vector<int64_t> length_doubling_PRG(int64_t seed) {
-    vector<int64_t> output(2);
-    std::random_device rd;
-    std::mt19937_64 gen(rd());
-    std::uniform_int_distribution<int64_t> dis(1, PRIME);
-    gen.seed(seed);
-    output[0] = dis(gen);
-    output[1] = dis(gen);
-    return output;
-}
 
-/*
-A function that extends the seeds and flags of a layer to the next layer using length_doubling_PRG.
-*/
-void expand_layer(vector<int64_t> &seeds, vector<uint8_t> &flags) {
-    int n = seeds.size();
-    vector<int64_t> new_seeds(2 * n);
-    vector<uint8_t> new_flags(2 * n);
-    for(int i = 0;i < n;i++) {
-        vector<int64_t> prg_output = length_doubling_PRG(seeds[i]);
-        new_seeds[2 * i] = prg_output[0];
-        new_seeds[2 * i + 1] = prg_output[1];
-        new_flags[2 * i] = prg_output[0]%2;
-        new_flags[2 * i + 1] = prg_output[1]%2;
+    vector<uint64_t> indices(domain_size != 0 ? min<uint64_t>(domain_size, 64) : 64);
+    for(auto& index : indices) {
+        index = random_index(domain_size);
     }
-    seeds = new_seeds;
-    flags = new_flags;
-}
-
-/*
-A function that generates DPF keys for two parties given the domain size, target index and target value.
-It returns a vector of size 2 containing the DPF keys for both parties.
-*/
-vector<dpf_key_type> generateDPF(int64_t domain_size, int64_t target_index, int64_t target_value) {
-    
-    // CHECK: target_index in [0, domain_size)
-    assert(target_index < domain_size);
-
-    // Increase domain size to nearest power of 2
-    if((domain_size & (domain_size - 1)) != 0) {
-        int new_domain_size = 1;
-        while(new_domain_size < domain_size) {
-            new_domain_size *= 2;
+    indices.push_back(target_index);
+    indices.push_back(target_index - 1);
+    indices.push_back(target_index + 1);
+    if(domain_size != 0) {
+        erase_if(indices, [&](uint64_t index) { return index >= domain_size; });
+    }
+    sort(indices.begin(), indices.end());
+    vector<int64_t> left_points(indices.size()), right_points(indices.size());
+    EvalPoints(dpf_keys[0], indices, left_points);
+    EvalPoints(dpf_keys[1], indices, right_points);
+
+    // A range evaluation of a window around the target, which is all a shard of the domain expands
+    uint64_t last = domain_size - 1;
+    uint64_t lo = target_index - min<uint64_t>(target_index, RANGE_CHECK_WIDTH);
+    uint64_t hi = target_index + min(last - target_index, RANGE_CHECK_WIDTH);
+    vector<int64_t> left_range = EvalRange(dpf_keys[0], lo, hi);
+    vector<int64_t> right_range = EvalRange(dpf_keys[1], lo, hi);
+    for(uint64_t k = lo; k <= hi; k++) {
+        if((left_range[k - lo] ^ right_range[k - lo]) != (k == target_index ? target_value : 0)) {
+            return false;
         }
-        domain_size = new_domain_size;
     }
-    
-    // CHECK: domain_size is power of 2
-    assert((domain_size & (domain_size - 1)) == 0);
-
-    // Initialize DPF keys for both parties
-    vector<dpf_key_type> dpf_keys(2);
-    
-    // Initialize root seeds of both DPF trees
-    dpf_keys[0].root = random_uint();
-    dpf_keys[1].root = random_uint();
-    
-    int64_t initialize_flags = random_uint();
-    dpf_keys[0].flag = initialize_flags % 2;
-    dpf_keys[1].flag = (initialize_flags + 1) % 2;
-
-    // CHECK: root flags are different
-    assert(dpf_keys[0].flag != dpf_keys[1].flag);
-
-    int max_depth = log2(domain_size);
-
-    // Vectors to hold seeds and flags at current layer for both trees
-    vector<int64_t> left_tree_seeds, right_tree_seeds;
-    vector<uint8_t> left_tree_flags, right_tree_flags;
-
-    // Initially current layer has only root seed and flag
-    left_tree_seeds.push_back(dpf_keys[0].root);
-    right_tree_seeds.push_back(dpf_keys[1].root);
-    left_tree_flags.push_back(dpf_keys[0].flag);
-    right_tree_flags.push_back(dpf_keys[1].flag);
-
-    for(int layer = 1;layer <= max_depth;layer++) {
-
-        // Determine direction to target node at current layer (0 means left, 1 means right)
-        int direction = (target_index >> (max_depth - layer)) & 1;
-        // Index of node in current layer that is in the path to target node
-        int direction_among_child = target_index / (1<<(max_depth-layer));
-
-        vector<int64_t> old_left_tree_seeds = left_tree_seeds;
-        vector<int64_t> old_right_tree_seeds = right_tree_seeds;
-        vector<uint8_t> old_left_tree_flags = left_tree_flags;
-        vector<uint8_t> old_right_tree_flags = right_tree_flags;
-
-        // Expand both trees to next layer
-        expand_layer(left_tree_seeds, left_tree_flags);
-        expand_layer(right_tree_seeds, right_tree_flags);
-        
-        int64_t L0 = left_tree_seeds[0],L1 = right_tree_seeds[0],R0 = left_tree_seeds[1],R1 = right_tree_seeds[1];
-        uint8_t fL0 = left_tree_flags[0],fL1 = right_tree_flags[0],fR0 = left_tree_flags[1],fR1 = right_tree_flags[1];
-        
-        for(int i=2;i<(1<<layer);i++) {
-            if(i%2) {
-                R0 = R0 ^ left_tree_seeds[i];
-                R1 = R1 ^ right_tree_seeds[i];
 
-                fR0 = fR0 ^ left_tree_flags[i];
-                fR1 = fR1 ^ right_tree_flags[i];
-                // CHECK: flags should be either 0 or 1
-                assert(fR0 <= 1 && fR1 <= 1);
-            } else {
-                L0 = L0 ^ left_tree_seeds[i];
-                L1 = L1 ^ right_tree_seeds[i];
-                
-                fL0 = fL0 ^ left_tree_flags[i];
-                fL1 = fL1 ^ right_tree_flags[i];
-                // CHECK: flags should be either 0 or 1
-                assert(fL0 <= 1 && fL1 <= 1);
+    if(domain_size == 0 || domain_size > FULL_CHECK_LIMIT) {
+        for(size_t i = 0;i < indices.size();i++) {
+            int64_t val = left_points[i] ^ right_points[i];
+            if(val != (indices[i] == target_index ? target_value : 0)) {
+                return false;
             }
         }
+        return true;
+    }
 
-        // Compute correction words based on direction
-        int64_t cw,fcw0,fcw1;
-        if(direction){
-            cw = L0 ^ L1;
-            fcw0 = fL0 ^ fL1;
-            fcw1 = fR0 ^ fR1 ^ 1;
-            
-            // CHECK: flags should be either 0 or 1
-            assert(fcw0 <= 1);
-            assert(fcw1 <= 1);
-        }else{
-            cw = R0 ^ R1;
-            fcw0 = fR0 ^ fR1;
-            fcw1 = fL0 ^ fL1 ^ 1;
-            
-            // CHECK: flags should be either 0 or 1
-            assert(fcw1 <= 1);
-            assert(fcw0 <= 1);
-        }
-
-        dpf_keys[0].cw.push_back(cw);
-        dpf_keys[0].fcw0.push_back(fcw0);
-        dpf_keys[0].fcw1.push_back(fcw1);
-    
-        dpf_keys[1].cw.push_back(cw);
-        dpf_keys[1].fcw0.push_back(fcw0);
-        dpf_keys[1].fcw1.push_back(fcw1);
+    vector<int64_t> left_tree_result = EvalFull(domain_size, dpf_keys[0], pool);
+    vector<int64_t> right_tree_result = EvalFull(domain_size, dpf_keys[1], pool);
 
-        // Apply correction words to the seeds and flags in current layer before proceeding to next layer
-        for(int i = 0;i < (1<<layer);i++) {
-            if(old_left_tree_flags[i/2]) {
-                left_tree_seeds[i] = left_tree_seeds[i] ^ cw;
-                if(i == direction_among_child) {
-                    left_tree_flags[i] = left_tree_flags[i] ^ fcw1;
-                } else {
-                    left_tree_flags[i] = left_tree_flags[i] ^ fcw0;
-                }
-                // CHECK: flags should be either 0 or 1
-                assert(left_tree_flags[i] <= 1);
+    for(uint64_t k = 0; k < domain_size; k++) {
+        int64_t val = left_tree_result[k] ^ right_tree_result[k];
+        if(k != target_index) {
+            if(val != 0){
+                return false;
             }
-            if(old_right_tree_flags[i/2]) {
-                right_tree_seeds[i] = right_tree_seeds[i] ^ cw;
-                if(i == direction_among_child) {
-                    right_tree_flags[i] = right_tree_flags[i] ^ fcw1;
-                } else {
-                    right_tree_flags[i] = right_tree_flags[i] ^ fcw0;
-                }
-                // CHECK: flags should be either 0 or 1
-                assert(right_tree_flags[i] <= 1);
+        } else {
+            if(val != target_value){
+                return false;
             }
         }
+    }
 
-        // if we are in final layer set final correction word
-        if(layer == max_depth) {
-            int64_t final_cw;
-            for(int i=0;i<(1<<layer);i++){
-                if(i == direction_among_child){
-                    final_cw = (left_tree_seeds[i] ^ right_tree_seeds[i] ^ target_value);
-                }
-            }
-            dpf_keys[0].final_cw = final_cw;
-            dpf_keys[1].final_cw = final_cw;
+    // The point evaluations must agree with the full evaluation
+    for(size_t i = 0;i < indices.size();i++) {
+        if(left_points[i] != left_tree_result[indices[i]] || right_points[i] != right_tree_result[indices[i]]) {
+            return false;
         }
     }
-    return dpf_keys;
+    return true;
 }
 
-
 /*
-A function that evaluates a DPF key at a specific target index and returns the resulting vector.
+A function that checks an arithmetic DPF over the given ring with a random signed payload at target_index:
+the outputs of both keys must add up to the payload at target_index and to zero everywhere else.
+The payload always holds a negative entry, whose residue modulo PRIME is computed with 128-bit integers.
+Like check_dpf_correctness it only checks sampled indices for domains larger than FULL_CHECK_LIMIT.
 */
-vector<int64_t> EvalFull(int64_t domain_size, dpf_key_type dpf_key,int64_t target_index){
-    int max_depth = dpf_key.cw.size();
-
-    vector<int64_t> seeds(1);
-    vector<uint8_t> flags(1);
-
-    seeds[0] = dpf_key.root;
-    flags[0] = dpf_key.flag;
-
-    int64_t final_cw = dpf_key.final_cw;
-    for(int layer = 0;layer < max_depth;layer++) {
-        int direction_among_child = target_index / (1<<(max_depth-1-layer));
-        vector<int64_t> old_seeds = seeds;
-        vector<uint8_t> old_flags = flags;
-        expand_layer(seeds, flags);
-        int n = seeds.size();
-        
-        // CHECK: n should be 2^(layer+1) and direction_among_child should be in [0, n)
-        assert(n == (1<<(layer+1)));
-        assert(direction_among_child < n);
-        
-        for(int i = 0;i < n;i++) {
-            uint8_t parent_flag = old_flags[i/2];
-            int64_t parent_seed = old_seeds[i/2];
-            if(parent_flag) {
-
-                seeds[i] = seeds[i] ^ dpf_key.cw[layer];
+bool check_arithmetic_dpf_correctness(uint64_t domain_size, uint64_t target_index, output_ring ring) {
+    int k = ARITHMETIC_PAYLOAD_LENGTH;
+    vector<int64_t> payload(k), expected(k);
+    for(int j = 0;j < k;j++) {
+        payload[j] = j == 0 ? -(int64_t)(random_index(0) % ALPHA) - 1 : (int64_t)random_index(0);
+        __int128 residue = (__int128)payload[j] % PRIME;
+        expected[j] = ring == RING_PRIME ? (int64_t)(residue < 0 ? residue + PRIME : residue) : payload[j];
+    }
+    vector<arithmetic_dpf_key_type> keys = generateArithmeticDPF(domain_size, target_index, payload, ring);
 
-                // CHECK: flags should be either 0 or 1
-                assert(dpf_key.fcw0[layer] <= 1);
-                assert(dpf_key.fcw1[layer] <= 1);
-                if(i == direction_among_child) {
-                    flags[i] = flags[i] ^ dpf_key.fcw1[layer];
-                } else {
-                    flags[i] = flags[i] ^ dpf_key.fcw0[layer];
-                }
-                // CHECK: flags should be either 0 or 1
-                assert(flags[i] <= 1);
+    auto check = [&](uint64_t index, const int64_t* left, const int64_t* right) {
+        for(int j = 0;j < k;j++) {
+            if(ring_add(ring, left[j], right[j]) != (index == target_index ? expected[j] : 0)) {
+                return false;
             }
         }
+        return true;
+    };
+
+    vector<int64_t> left(k), right(k);
+    vector<uint64_t> indices = {target_index, target_index - 1, target_index + 1};
+    for(int i = 0;i < 64;i++) {
+        indices.push_back(random_index(domain_size));
+    }
+    for(uint64_t index : indices) {
+        if(domain_size != 0 && index >= domain_size) {
+            continue;
+        }
+        Eval(keys[0], index, left);
+        Eval(keys[1], index, right);
+        if(!check(index, left.data(), right.data())) {
+            return false;
+        }
     }
 
-    // apply final correction word
-    for(int i = 0;i < seeds.size();i++) {
-        if(flags[i]) {
-            seeds[i] = seeds[i] ^ dpf_key.final_cw;
+    if(domain_size == 0 || domain_size > FULL_CHECK_LIMIT) {
+        return true;
+    }
+    vector<int64_t> left_tree_result = EvalFull(domain_size, keys[0]);
+    vector<int64_t> right_tree_result = EvalFull(domain_size, keys[1]);
+    for(uint64_t index = 0;index < domain_size;index++) {
+        if(!check(index, left_tree_result.data() + index * k, right_tree_result.data() + index * k)) {
+            return false;
         }
     }
+    return true;
+}
 
-    // Trim to domain size
-    vector<int64_t> result(domain_size, 0);
-    for(int i = 0;i < domain_size;i++) {
-        result[i] = seeds[i];
+/*
+A function that checks the serialized keys of a DPF: the views of both keys in the key stores must
+evaluate like the keys at the target and its neighbours, and the keys must survive a round trip
+through serialize_dpf_key and deserialize_dpf_key.
+*/
+bool check_serialized_keys(uint64_t domain_size, uint64_t target_index, const vector<dpf_key_type>& keys, const dpf_key_view& left_view, const dpf_key_view& right_view) {
+    for(uint64_t index : {target_index - 1, target_index, target_index + 1}) {
+        if(domain_size != 0 && index >= domain_size) {
+            continue;
+        }
+        if(Eval(left_view, index) != Eval(keys[0], index) || Eval(right_view, index) != Eval(keys[1], index)) {
+            return false;
+        }
     }
-    return result;
+    for(const dpf_key_type& key : keys) {
+        dpf_key_type copy = deserialize_dpf_key(serialize_dpf_key(key));
+        if(copy.root != key.root || copy.flag != key.flag || copy.cw != key.cw || copy.fcw0 != key.fcw0 || copy.fcw1 != key.fcw1 || copy.final_cw != key.final_cw) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /*
-A function that checks the correctness of the generated DPF keys by evaluating them and verifying the output.
+A function that checks that key headers whose sizes do not fit in the key file are rejected with a
+runtime_error instead of being read past the end of the file: a key size that wraps around to 0 or
+to a few words, and a number of keys whose total size overflows.
 */
-bool check_dpf_correctness(int64_t domain_size, int64_t target_index, int64_t target_value, vector<dpf_key_type> dpf_keys) {
-    vector<int64_t> left_tree_result = EvalFull(domain_size, dpf_keys[0], target_index);
-    vector<int64_t> right_tree_result = EvalFull(domain_size, dpf_keys[1], target_index);
+bool check_malformed_key_headers() {
+    const uint64_t MAX = numeric_limits<uint64_t>::max();
+    vector<key_header> headers = {
+        {KEY_ARITHMETIC, RING_2_64, 0, MAX - 1, 1}, // 2 + final_words wraps to 0
+        {KEY_ARITHMETIC, RING_2_64, 0, MAX, 1},     // 2 + final_words wraps to 1
+        {KEY_ARITHMETIC, RING_PRIME, 3, 4, 1},      // one word short
+        {KEY_XOR, RING_2_64, 0, 1, MAX / 2},        // count * key size overflows
+    };
+    for(const key_header& header : headers) {
+        vector<uint64_t> words(KEY_HEADER_WORDS + 8, 0);
+        write_key_header(header, words.data());
+        try {
+            read_key_header(words);
+            return false;
+        } catch(const runtime_error&) {
+        }
+    }
+    return true;
+}
 
-    for(int k = 0; k < domain_size; k++) {
-        int64_t val = left_tree_result[k] ^ right_tree_result[k];
-        if(k != target_index) {
-            if(val != 0){
-                return false;
+/*
+A function that checks that an exception thrown by a task of parallel_for, on the calling thread or
+on a worker, reaches the caller after all running tasks have finished, and that the pool still works.
+*/
+bool check_thread_pool_exceptions() {
+    thread_pool pool(4);
+    for(bool on_caller : {true, false}) {
+        // The threads that do not throw wait until one has thrown, so that both cases always happen
+        atomic<bool> thrown{false};
+        atomic<size_t> running{0};
+        auto task = [&](size_t, size_t worker) {
+            if((worker == 0) == on_caller) {
+                thrown = true;
+                throw runtime_error("task failed");
             }
-        } else {
-            if(val != target_value){
+            running++;
+            while(!thrown) {
+                this_thread::sleep_for(chrono::microseconds(100));
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+            running--;
+        };
+        try {
+            pool.parallel_for(64, task);
+            return false;
+        } catch(const runtime_error&) {
+            if(running != 0) {
                 return false;
             }
         }
     }
-    return true;
+    atomic<size_t> sum{0};
+    pool.parallel_for(100, [&](size_t i, size_t) { sum += i; });
+    return sum == 4950;
+}
+
+/*
+A function that parses a domain size given either as a number or as a power of two "2^k" with k <= 64.
+Returns false if the argument is not a valid domain size.
+*/
+bool parse_domain_size(const char* arg, uint64_t& domain_size) {
+    char* end;
+    errno = 0;
+    if(arg[0] == '2' && arg[1] == '^') {
+        uint64_t k = strtoull(arg + 2, &end, 10);
+        if(errno != 0 || *end != '\0' || end == arg + 2 || k > 64) {
+            return false;
+        }
+        domain_size = k == 64 ? 0 : uint64_t(1) << k;
+        return true;
+    }
+    domain_size = strtoull(arg, &end, 10);
+    return errno == 0 && *end == '\0' && end != arg && arg[0] != '-' && domain_size != 0;
 }
 
-/* take command line arguments <domain_size> <no of dpfs> <verbose> */
+/* take command line arguments <domain_size> <no of dpfs> <verbose> [threads] [leaf_lanes] */
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        cerr << "Usage: dpf.exe <domain_size> <no of dpfs> <verbose>" << endl << "Verbose: 1 for detailed output, 0 for minimal output" << endl;
+    if (argc < 4 || argc > 6) {
+        cerr << "Usage: dpf.exe <domain_size> <no of dpfs> <verbose> [threads] [leaf_lanes]" << endl << "Domain size: a number or a power of two 2^k with k <= 64" << endl << "Verbose: 1 for detailed output, 0 for minimal output" << endl << "Threads: number of threads used by EvalFull, all cores by default" << endl << "Leaf lanes: outputs packed into each leaf of the tree, a power of 2 (1 by default)" << endl;
         return 1;
     }
     
-    int domain_size = atoi(argv[1]);
+    uint64_t domain_size;
+    if(!parse_domain_size(argv[1], domain_size)){
+        cerr << "Domain size should be a positive number or 2^k with k <= 64" << endl;
+        return 1;
+    }
     int num_dpf = atoi(argv[2]);
     int verbose = atoi(argv[3]);
+    int threads = argc >= 5 ? atoi(argv[4]) : thread::hardware_concurrency();
+    int lanes = argc == 6 ? atoi(argv[5]) : 1;
 
     if(verbose!=0 && verbose!=1){
         cerr << "Verbose should be either 0 or 1" << endl;
         return 1;
     }
+    if(threads < 1){
+        cerr << "Threads should be at least 1" << endl;
+        return 1;
+    }
+    if(lanes < 1 || lanes > 1024 || (lanes & (lanes - 1)) != 0){
+        cerr << "Leaf lanes should be a power of 2 between 1 and 1024" << endl;
+        return 1;
+    }
+    thread_pool pool(threads);
+
+    // Evaluations are only printed for domains that are materialized
+    bool print = verbose && domain_size != 0 && domain_size <= FULL_CHECK_LIMIT;
+
+    // Generate the keys of all DPFs in one batch
+    vector<uint64_t> target_indices(num_dpf);
+    vector<int64_t> target_values(num_dpf);
+    for( int i=0;i<num_dpf;i++){
+        target_indices[i] = random_index(domain_size);
+        target_values[i] = random_uint() % ALPHA; // target value in [0, ALPHA)
+    }
+    auto start = chrono::steady_clock::now();
+    vector<vector<dpf_key_type>> all_keys = generateDPFBatch(domain_size, target_indices, target_values, pool, lanes);
+    double keygen_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (verbose) cout << "Generated " << num_dpf << " key pairs in " << keygen_time * 1000 << " ms" << endl << endl;
+
+    // Serialize the keys of each party into a key store, as a server would load them from a key file
+    vector<dpf_key_type> party_keys[2];
+    for(auto& pair : all_keys) {
+        party_keys[0].push_back(pair[0]);
+        party_keys[1].push_back(pair[1]);
+    }
+    vector<uint64_t> serialized_keys[2];
+    optional<dpf_key_store> stores[2];
+    for(int b = 0;b < 2 && num_dpf > 0;b++) {
+        serialized_keys[b] = serialize_keys(span<const dpf_key_type>(party_keys[b]));
+        stores[b].emplace(span<const uint64_t>(serialized_keys[b]));
+    }
 
     for( int i=0;i<num_dpf;i++){
-        int target_index = random_uint() % domain_size;
-        int target_value = random_uint() % ALPHA; // target value in [0, ALPHA)
+        uint64_t target_index = target_indices[i];
+        int64_t target_value = target_values[i];
 
         if (verbose) cout<<"DPF: " << i+1 << ", target index: " << target_index << ", target value: " << target_value << endl;
         
-        vector<dpf_key_type> keys = generateDPF(domain_size, target_index, target_value);
-        vector<int64_t> left_tree_result = EvalFull(domain_size, keys[0], target_index);
-        vector<int64_t> right_tree_result = EvalFull(domain_size, keys[1], target_index);
+        const vector<dpf_key_type>& keys = all_keys[i];
+
+        if (print) {
+            vector<int64_t> left_tree_result = EvalFull(domain_size, keys[0], pool);
+            vector<int64_t> right_tree_result = EvalFull(domain_size, keys[1], pool);
 
-        if (verbose){ 
             cout << "Left tree evaluation: ";
-            for(int k = 0; k < domain_size; k++) {
+            for(uint64_t k = 0; k < domain_size; k++) {
                 int64_t val = left_tree_result[k];
                 if(k != target_index) {
                     cout << val << " ";
@@ -340,11 +317,9 @@ int main(int argc, char* argv[]) {
                     cout << "[" << val << "] ";
                 }
             }
-        }
 
-        if (verbose) {
             cout << "\nRight tree evaluation: ";
-            for(int k = 0; k < domain_size; k++) {
+            for(uint64_t k = 0; k < domain_size; k++) {
                 int64_t val = right_tree_result[k];
                 if(k != target_index) {
                     cout << val << " ";
@@ -352,11 +327,9 @@ int main(int argc, char* argv[]) {
                     cout << "[" << val << "] ";
                 }
             }
-        }
 
-        if (verbose) {
             cout << "\nXOR of both evaluations: ";
-            for(int k = 0; k < domain_size; k++) {
+            for(uint64_t k = 0; k < domain_size; k++) {
                 int64_t val = left_tree_result[k] ^ right_tree_result[k];
                 if(k != target_index) {
                     cout << val << " ";
@@ -366,10 +339,20 @@ int main(int argc, char* argv[]) {
             }
             cout << endl;
         }
-        
 
-        bool flag = check_dpf_correctness(domain_size, target_index, target_value, keys);
+        bool flag = check_dpf_correctness(domain_size, target_index, target_value, keys, pool);
+
+        // An arithmetic DPF with a vector payload at the same index, alternating between the rings
+        output_ring ring = i % 2 == 0 ? RING_2_64 : RING_PRIME;
+        bool arithmetic_flag = check_arithmetic_dpf_correctness(domain_size, target_index, ring);
+        if (verbose) cout << "Arithmetic DPF over " << (ring == RING_2_64 ? "Z_2^64" : "Z_PRIME") << ": " << (arithmetic_flag ? "PASSED" : "FAILED") << endl;
+        flag = flag && arithmetic_flag;
+        flag = flag && check_serialized_keys(domain_size, target_index, keys, (*stores[0])[i], (*stores[1])[i]);
         cout << "Final Verdict for DPF " << i+1 << ": " << (flag ? "PASSED" : "FAILED")<<endl<<endl;
     }
+    bool pool_flag = check_thread_pool_exceptions();
+    cout << "Final Verdict for thread pool exceptions: " << (pool_flag ? "PASSED" : "FAILED") << endl << endl;
+    bool header_flag = check_malformed_key_headers();
+    cout << "Final Verdict for malformed key headers: " << (header_flag ? "PASSED" : "FAILED") << endl << endl;
     return 0;
-}
\ No newline at end of file
+}
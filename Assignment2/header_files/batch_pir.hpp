@@ -0,0 +1,297 @@
+#pragma once
+#include <bits/stdc++.h>
+#include "dpf.hpp"
+#include "pir.hpp"
+using namespace std;
+
+/*
+Batch PIR with cuckoo hashing.
+
+Every index of the database is hashed into CUCKOO_HASHES of num_buckets buckets, and every bucket
+of the server lists the indices hashed into it. A client that wants m records places them in
+num_buckets = CUCKOO_EXPANSION * m buckets by cuckoo hashing, so that each bucket holds at most one
+of them, and sends one small DPF per bucket selecting the position of its record inside the bucket
+(buckets without a record get a DPF for a random position). The server expands each key only over
+its own bucket, so a batch of m queries costs CUCKOO_HASHES passes over the database instead of m.
+The records are read from the (memory mapped) database through the indices, they are not copied.
+*/
+
+const int CUCKOO_HASHES = 3;
+const double CUCKOO_EXPANSION = 1.5;
+const int CUCKOO_MAX_EVICTIONS = 1000;
+
+/*
+The public parameters of a batch, known to the client and to the servers.
+*/
+struct cuckoo_params {
+    uint64_t num_records;
+    uint64_t num_buckets;
+    uint64_t seed;
+};
+
+cuckoo_params make_cuckoo_params(uint64_t num_records, size_t batch_size, uint64_t seed) {
+    uint64_t num_buckets = max<uint64_t>(1, (uint64_t)ceil(CUCKOO_EXPANSION * batch_size));
+    return {num_records, num_buckets, seed};
+}
+
+/*
+The j-th bucket of an index, from a splitmix64 hash of (seed, j, index) mapped to [0, num_buckets)
+by a multiply-shift instead of a modulo.
+*/
+uint64_t bucket_hash(const cuckoo_params& params, int j, uint64_t index) {
+    uint64_t x = params.seed + (uint64_t)(j + 1) * 0x9e3779b97f4a7c15ULL + index * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (uint64_t)(((unsigned __int128)x * params.num_buckets) >> 64);
+}
+
+/*
+The contents of the buckets: the indices of bucket b are sorted and stored at
+[offsets[b], offsets[b + 1]) of indices. An index whose hashes collide is stored once per bucket.
+*/
+class bucket_layout {
+public:
+    explicit bucket_layout(const cuckoo_params& params) : params(params), offsets(params.num_buckets + 1, 0) {
+        // Count the indices of every bucket, then fill the buckets in increasing order of index
+        for(int pass = 0;pass < 2;pass++) {
+            vector<uint64_t> cursor;
+            if(pass == 1) {
+                for(uint64_t b = 0;b < params.num_buckets;b++) {
+                    offsets[b + 1] += offsets[b];
+                }
+                cursor.assign(offsets.begin(), offsets.end() - 1);
+                indices.resize(offsets.back());
+            }
+            for(uint64_t index = 0;index < params.num_records;index++) {
+                uint64_t buckets[CUCKOO_HASHES];
+                int distinct = unique_buckets(index, buckets);
+                for(int j = 0;j < distinct;j++) {
+                    if(pass == 0) {
+                        offsets[buckets[j] + 1]++;
+                    } else {
+                        indices[cursor[buckets[j]]++] = index;
+                    }
+                }
+            }
+        }
+    }
+
+    const cuckoo_params& parameters() const { return params; }
+    uint64_t num_buckets() const { return params.num_buckets; }
+    uint64_t bucket_size(uint64_t b) const { return offsets[b + 1] - offsets[b]; }
+    uint64_t bucket_offset(uint64_t b) const { return offsets[b]; }
+    uint64_t total_size() const { return indices.size(); }
+    span<const uint64_t> bucket(uint64_t b) const { return span<const uint64_t>(indices).subspan(offsets[b], bucket_size(b)); }
+
+    // The largest bucket, which sets the domain of the DPF keys
+    uint64_t max_bucket_size() const {
+        uint64_t size = 1;
+        for(uint64_t b = 0;b < params.num_buckets;b++) {
+            size = max(size, bucket_size(b));
+        }
+        return size;
+    }
+
+    // The position of an index inside one of its buckets
+    uint64_t position(uint64_t b, uint64_t index) const {
+        span<const uint64_t> contents = bucket(b);
+        auto it = lower_bound(contents.begin(), contents.end(), index);
+        assert(it != contents.end() && *it == index);
+        return it - contents.begin();
+    }
+
+    // The distinct buckets of an index, returns their number
+    int unique_buckets(uint64_t index, uint64_t* buckets) const {
+        int distinct = 0;
+        for(int j = 0;j < CUCKOO_HASHES;j++) {
+            uint64_t b = bucket_hash(params, j, index);
+            if(find(buckets, buckets + distinct, b) == buckets + distinct) {
+                buckets[distinct++] = b;
+            }
+        }
+        return distinct;
+    }
+
+private:
+    cuckoo_params params;
+    vector<uint64_t> offsets;
+    vector<uint64_t> indices;
+};
+
+/*
+The server side of batch PIR: the bucket layout of a database. The buckets only hold indices,
+CUCKOO_HASHES words per record whatever the size of the records, and the records are read from
+the database, which must outlive the cuckoo_database.
+*/
+class cuckoo_database {
+public:
+    cuckoo_database(const pir_database& db, const cuckoo_params& params) : layout(params), db(db) {
+        if(params.num_records != db.size()) {
+            throw invalid_argument("the cuckoo parameters do not match the size of the database");
+        }
+    }
+
+    const bucket_layout& buckets() const { return layout; }
+    const pir_database& database() const { return db; }
+    size_t record_words() const { return db.record_words(); }
+
+private:
+    bucket_layout layout;
+    const pir_database& db;
+};
+
+/*
+XORs into answer the records at indices[i] whose selection bit (bit 0 of outputs[i]) is set.
+The indices of a bucket are sorted, so the records are read front to back.
+*/
+void xor_accumulate_indices(uint64_t* answer, const pir_database& db, const uint64_t* indices, const int64_t* outputs, size_t count, size_t words) {
+    for(size_t i = 0;i < count;i++) {
+        uint64_t mask = -(uint64_t)(outputs[i] & 1);
+        const uint64_t* record = db.record(indices[i]);
+        for(size_t j = 0;j < words;j++) {
+            answer[j] ^= record[j] & mask;
+        }
+    }
+}
+
+/*
+The client side of a batch: bucket_of[q] is the bucket holding targets[q], and keys[b] holds
+the DPF key of every bucket for server b.
+*/
+struct batch_query {
+    vector<uint64_t> bucket_of;
+    vector<dpf_key_type> keys[2];
+};
+
+/*
+A function that places the targets into the buckets by cuckoo hashing. Repeated targets share
+a bucket. Throws runtime_error if the targets cannot be placed (the client then needs a new seed),
+which happens with negligible probability for CUCKOO_HASHES = 3 and CUCKOO_EXPANSION = 1.5.
+*/
+vector<uint64_t> cuckoo_place(const bucket_layout& layout, span<const uint64_t> targets) {
+    vector<uint64_t> items(targets.begin(), targets.end());
+    sort(items.begin(), items.end());
+    items.erase(unique(items.begin(), items.end()), items.end());
+
+    const int64_t EMPTY = -1;
+    vector<int64_t> occupant(layout.num_buckets(), EMPTY); // item held by each bucket
+    for(size_t item = 0;item < items.size();item++) {
+        int64_t current = item;
+        uint64_t previous = layout.num_buckets();
+        bool placed = false;
+        for(int evictions = 0;evictions <= CUCKOO_MAX_EVICTIONS && !placed;evictions++) {
+            uint64_t buckets[CUCKOO_HASHES];
+            int distinct = layout.unique_buckets(items[current], buckets);
+            for(int j = 0;j < distinct && !placed;j++) {
+                if(occupant[buckets[j]] == EMPTY) {
+                    occupant[buckets[j]] = current;
+                    placed = true;
+                }
+            }
+            if(!placed) {
+                // Evict the item of a random bucket other than the one we were just evicted from
+                uint64_t b;
+                do {
+                    b = buckets[random_index(distinct)];
+                } while(distinct > 1 && b == previous);
+                swap(current, occupant[b]);
+                previous = b;
+            }
+        }
+        if(!placed) {
+            throw runtime_error("cuckoo hashing failed to place the batch, retry with another seed");
+        }
+    }
+
+    vector<uint64_t> bucket_of_item(items.size());
+    for(uint64_t b = 0;b < layout.num_buckets();b++) {
+        if(occupant[b] != EMPTY) {
+            bucket_of_item[occupant[b]] = b;
+        }
+    }
+    vector<uint64_t> bucket_of(targets.size());
+    for(size_t q = 0;q < targets.size();q++) {
+        bucket_of[q] = bucket_of_item[lower_bound(items.begin(), items.end(), targets[q]) - items.begin()];
+    }
+    return bucket_of;
+}
+
+/*
+A function that builds the keys of a batch of queries. All keys share the domain of the largest
+bucket, so that the keys of every bucket have the same size, and they are generated in one
+generateDPFBatch call.
+*/
+batch_query generate_batch_query(const bucket_layout& layout, span<const uint64_t> targets, thread_pool& pool) {
+    batch_query query;
+    query.bucket_of = cuckoo_place(layout, targets);
+
+    uint64_t num_buckets = layout.num_buckets();
+    vector<uint64_t> positions(num_buckets);
+    vector<bool> used(num_buckets, false);
+    for(size_t q = 0;q < targets.size();q++) {
+        uint64_t b = query.bucket_of[q];
+        positions[b] = layout.position(b, targets[q]);
+        used[b] = true;
+    }
+    for(uint64_t b = 0;b < num_buckets;b++) {
+        if(!used[b]) {
+            positions[b] = random_index(max<uint64_t>(layout.bucket_size(b), 1));
+        }
+    }
+
+    vector<int64_t> ones(num_buckets, 1);
+    vector<vector<dpf_key_type>> pairs = generateDPFBatch(layout.max_bucket_size(), positions, ones, pool);
+    for(auto& pair : pairs) {
+        query.keys[0].push_back(move(pair[0]));
+        query.keys[1].push_back(move(pair[1]));
+    }
+    return query;
+}
+
+/*
+A function that answers the keys of a batch, one per bucket. Each key is expanded only over the
+positions of its bucket and the selected record is read from the database and XORed into the
+answer of the bucket. Throws invalid_argument if a key does not cover its bucket.
+*/
+vector<vector<uint64_t>> answer_batch(const cuckoo_database& db, span<const dpf_key_type> keys, thread_pool& pool) {
+    const bucket_layout& layout = db.buckets();
+    if(keys.size() != layout.num_buckets()) {
+        throw invalid_argument("batch PIR needs one key per bucket");
+    }
+    for(size_t b = 0;b < keys.size();b++) {
+        check_key_domains(keys.subspan(b, 1), layout.bucket_size(b));
+    }
+    size_t words = db.record_words();
+    vector<vector<uint64_t>> answers(keys.size(), vector<uint64_t>(words, 0));
+    vector<dpf_block_evaluator> evaluators;
+    for(size_t worker = 0;worker < pool.size();worker++) {
+        evaluators.emplace_back(pir_block_levels(words));
+    }
+
+    pool.parallel_for(keys.size(), [&](size_t b, size_t worker) {
+        if(layout.bucket_size(b) == 0) {
+            return;
+        }
+        const uint64_t* indices = layout.bucket(b).data();
+        EvalFullBlocks(layout.bucket_size(b), keys[b], evaluators[worker], [&](uint64_t first_index, span<const int64_t> block, span<const uint8_t>) {
+            xor_accumulate_indices(answers[b].data(), db.database(), indices + first_index, block.data(), block.size(), words);
+        });
+    });
+    return answers;
+}
+
+/*
+A function that reconstructs the records of the targets of a batch from the answers of both servers.
+*/
+vector<vector<uint64_t>> reconstruct_batch(const batch_query& query, const vector<vector<uint64_t>>& left, const vector<vector<uint64_t>>& right) {
+    vector<vector<uint64_t>> records;
+    for(uint64_t b : query.bucket_of) {
+        vector<uint64_t> record(left[b].size());
+        for(size_t j = 0;j < record.size();j++) {
+            record[j] = left[b][j] ^ right[b][j];
+        }
+        records.push_back(move(record));
+    }
+    return records;
+}
@@ -0,0 +1,888 @@
+#pragma once
+#include <bits/stdc++.h>
+#include <span>
+#include "../../common/prg.hpp"
+#include "thread_pool.hpp"
+#include "dpf_key.hpp"
+#include "key_store.hpp"
+using namespace std;
+
+int64_t PRIME = 2305843009213693951; // 2^61 - 1
+
+/*
+Domains are sets of 64-bit indices [0, domain_size). A domain_size of 0 stands for the whole
+range of 2^64 indices, which does not fit in a uint64_t.
+*/
+
+/*
+A function to generate a random 64-bit integer in the range [1, PRIME).
+With the seed provided as argument it initializes the random number generator with that seed.
+*/
+inline int64_t random_uint(int seed=0) {
+    static std::random_device rd;
+    static std::mt19937_64 gen(rd());
+    if(seed != 0) {
+        gen.seed(seed);
+    }
+    static std::uniform_int_distribution<int64_t> dis(1, PRIME);
+    return dis(gen);
+}
+
+/*
+A function to generate a uniformly random index in [0, domain_size).
+*/
+inline uint64_t random_index(uint64_t domain_size) {
+    static std::mt19937_64 gen(std::random_device{}());
+    return domain_size == 0 ? gen() : gen() % domain_size;
+}
+
+/*
+A function that returns the depth of the DPF tree for a domain, i.e. log2 of the domain size
+rounded up to the nearest power of 2, computed with integer operations only.
+*/
+int dpf_depth(uint64_t domain_size) {
+    if(domain_size == 0) {
+        return 64;
+    }
+    return domain_size == 1 ? 0 : 64 - __builtin_clzll(domain_size - 1);
+}
+
+/*
+Functions for the arithmetic of the output rings. Elements of Z_PRIME are kept in [0, PRIME).
+ring_reduce reads value as a signed integer, so a negative payload -x becomes PRIME - (x mod PRIME).
+*/
+inline int64_t ring_reduce(output_ring ring, int64_t value) {
+    if(ring != RING_PRIME) {
+        return value;
+    }
+    uint64_t magnitude = (value < 0 ? 0 - (uint64_t)value : (uint64_t)value) % (uint64_t)PRIME;
+    return value < 0 && magnitude != 0 ? PRIME - magnitude : magnitude;
+}
+
+inline int64_t ring_add(output_ring ring, int64_t a, int64_t b) {
+    uint64_t sum = (uint64_t)a + (uint64_t)b;
+    if(ring == RING_PRIME && sum >= (uint64_t)PRIME) {
+        sum -= PRIME;
+    }
+    return sum;
+}
+
+inline int64_t ring_negate(output_ring ring, int64_t a) {
+    if(ring == RING_PRIME) {
+        return a == 0 ? 0 : PRIME - a;
+    }
+    return -(uint64_t)a;
+}
+
+/*
+A function that initializes the root seeds and flags of the trees of both parties with different flags.
+*/
+void initialize_roots(dpf_tree& tree0, dpf_tree& tree1) {
+    // Initialize root seeds of both DPF trees
+    tree0.root = random_uint();
+    tree1.root = random_uint();
+    
+    int64_t initialize_flags = random_uint();
+    tree0.flag = initialize_flags % 2;
+    tree1.flag = (initialize_flags + 1) % 2;
+
+    // CHECK: root flags are different
+    assert(tree0.flag != tree1.flag);
+}
+
+/*
+A function that generates the trees of up to KEYGEN_BATCH pairs of DPF keys in lock-step, for trees of
+max_depth layers. trees[2 * i] and trees[2 * i + 1] are the trees of both parties for pair i, whose roots
+are already initialized, with a path to target_leaves[i]. The nodes on the paths of all the trees in a
+layer are expanded by a single call of the PRG, so their AES rounds are pipelined.
+On return seeds[2 * i + b] and flags[2 * i + b] hold the leaf on the path of trees[2 * i + b].
+*/
+const size_t KEYGEN_BATCH = 8;
+
+void generate_trees(dpf_tree* const* trees, size_t pairs, int max_depth, const uint64_t* target_leaves, int64_t* seeds, uint8_t* flags) {
+    assert(pairs <= KEYGEN_BATCH);
+    size_t n = 2 * pairs;
+    for(size_t t = 0;t < n;t++) {
+        seeds[t] = trees[t]->root;
+        flags[t] = trees[t]->flag;
+        trees[t]->cw.reserve(max_depth);
+        trees[t]->fcw0.reserve(max_depth);
+        trees[t]->fcw1.reserve(max_depth);
+    }
+
+    // Only the node on the path to the target is followed in both trees. The trees of the two
+    // parties agree on every node off the path, so those nodes never affect the correction words.
+    for(int layer = 1;layer <= max_depth;layer++) {
+
+        // Expand the nodes on the paths of all trees
+        int64_t children[4 * KEYGEN_BATCH];
+        length_doubling_PRG(seeds, children, n);
+
+        for(size_t i = 0;i < pairs;i++) {
+            // Determine direction to target node at current layer (0 means left, 1 means right)
+            int direction = (target_leaves[i] >> (max_depth - layer)) & 1;
+            int lose = direction ^ 1;
+
+            const int64_t* child[2] = {children + 4 * i, children + 4 * i + 2};
+            uint8_t child_flags[2][2];
+            for(int b = 0;b < 2;b++) {
+                child_flags[b][0] = child[b][0] & 1;
+                child_flags[b][1] = child[b][1] & 1;
+            }
+
+            // The seed correction word makes the child off the path equal in both trees.
+            // The flag correction words keep the flags of the child off the path equal and
+            // the flags of the child on the path different.
+            int64_t cw = child[0][lose] ^ child[1][lose];
+            uint8_t fcw[2];
+            fcw[lose] = child_flags[0][lose] ^ child_flags[1][lose];
+            fcw[direction] = child_flags[0][direction] ^ child_flags[1][direction] ^ 1;
+
+            // CHECK: flags should be either 0 or 1
+            assert(fcw[0] <= 1 && fcw[1] <= 1);
+
+            // Apply correction words to the child on the path before proceeding to next layer
+            for(int b = 0;b < 2;b++) {
+                size_t t = 2 * i + b;
+                trees[t]->cw.push_back(cw);
+                trees[t]->fcw0.push_back(fcw[0]);
+                trees[t]->fcw1.push_back(fcw[1]);
+
+                int64_t next_seed = child[b][direction];
+                uint8_t next_flag = child_flags[b][direction];
+                if(flags[t]) {
+                    next_seed = next_seed ^ cw;
+                    next_flag = next_flag ^ fcw[direction];
+                }
+                seeds[t] = next_seed;
+                flags[t] = next_flag;
+            }
+        }
+    }
+
+    // CHECK: the flags at the target leaves are different
+    for(size_t i = 0;i < pairs;i++) {
+        assert(flags[2 * i] != flags[2 * i + 1]);
+    }
+}
+
+/*
+A function that generates the trees of the DPF keys of both parties for a tree of max_depth layers
+with a path to target_leaf. On return seed and flag hold the leaf on the path in both trees.
+*/
+void generate_tree(dpf_tree& tree0, dpf_tree& tree1, int max_depth, uint64_t target_leaf, int64_t seed[2], uint8_t flag[2]) {
+    initialize_roots(tree0, tree1);
+    dpf_tree* trees[2] = {&tree0, &tree1};
+    generate_trees(trees, 1, max_depth, &target_leaf, seed, flag);
+}
+
+/*
+A function that expands a leaf seed into its lanes (the seed itself when a leaf has a single lane).
+*/
+void expand_leaf(int64_t seed, int64_t* out, size_t lanes) {
+    if(lanes == 1) {
+        out[0] = seed;
+    } else {
+        expand_seed(seed, out, lanes);
+    }
+}
+
+/*
+A function that sets the final correction words of a pair of keys, given the seeds of the target leaf
+in both trees, so that the lanes of the target leaf XOR to target_value at the target lane and to 0
+at the other lanes. The final_cw of both keys must already have one element per lane, they are
+used to hold the lanes of the target leaf in the meantime.
+*/
+void set_final_cw(dpf_key_type& key0, dpf_key_type& key1, const int64_t seed[2], uint64_t target_lane, int64_t target_value) {
+    size_t leaf_lanes = key0.final_cw.size();
+    expand_leaf(seed[0], key0.final_cw.data(), leaf_lanes);
+    expand_leaf(seed[1], key1.final_cw.data(), leaf_lanes);
+    for(size_t lane = 0;lane < leaf_lanes;lane++) {
+        int64_t final_cw = key0.final_cw[lane] ^ key1.final_cw[lane];
+        if(lane == target_lane) {
+            final_cw ^= target_value;
+        }
+        key0.final_cw[lane] = final_cw;
+        key1.final_cw[lane] = final_cw;
+    }
+}
+
+/*
+A function that generates DPF keys for two parties given the domain size, target index and target value.
+Each leaf packs leaf_lanes outputs (a power of 2), so the tree is log2(leaf_lanes) layers shallower.
+It returns a vector of size 2 containing the DPF keys for both parties.
+*/
+vector<dpf_key_type> generateDPF(uint64_t domain_size, uint64_t target_index, int64_t target_value, int leaf_lanes = 1) {
+    
+    // CHECK: target_index in [0, domain_size)
+    assert(domain_size == 0 || target_index < domain_size);
+
+    // CHECK: leaf_lanes is a power of 2
+    assert(leaf_lanes >= 1 && (leaf_lanes & (leaf_lanes - 1)) == 0);
+
+    // Initialize DPF keys for both parties
+    vector<dpf_key_type> dpf_keys(2);
+
+    // The domain is rounded up to the nearest power of 2, and the last layers are replaced by the lanes
+    int lanes_log = __builtin_ctz(leaf_lanes);
+    int max_depth = max(dpf_depth(domain_size) - lanes_log, 0);
+    uint64_t target_leaf = target_index >> lanes_log;
+    uint64_t target_lane = target_index & (leaf_lanes - 1);
+
+    int64_t seed[2];
+    uint8_t flag[2];
+    generate_tree(dpf_keys[0], dpf_keys[1], max_depth, target_leaf, seed, flag);
+    dpf_keys[0].final_cw.resize(leaf_lanes);
+    dpf_keys[1].final_cw.resize(leaf_lanes);
+    set_final_cw(dpf_keys[0], dpf_keys[1], seed, target_lane, target_value);
+    return dpf_keys;
+}
+
+/*
+A function that generates the DPF keys of many DPFs at once, the i-th pair of keys having the
+target target_indices[i] and the value target_values[i]. The pairs are generated in batches of
+KEYGEN_BATCH whose trees are expanded in lock-step, and the batches are spread over the pool.
+It returns one vector of size 2 with the DPF keys for both parties per DPF.
+*/
+vector<vector<dpf_key_type>> generateDPFBatch(uint64_t domain_size, span<const uint64_t> target_indices, span<const int64_t> target_values, thread_pool& pool, int leaf_lanes = 1) {
+
+    // CHECK: one target value per target index
+    assert(target_indices.size() == target_values.size());
+
+    // CHECK: leaf_lanes is a power of 2
+    assert(leaf_lanes >= 1 && (leaf_lanes & (leaf_lanes - 1)) == 0);
+
+    size_t n = target_indices.size();
+    int lanes_log = __builtin_ctz(leaf_lanes);
+    int max_depth = max(dpf_depth(domain_size) - lanes_log, 0);
+
+    // The roots are drawn on the calling thread, since the random number generator is not thread safe
+    vector<vector<dpf_key_type>> dpf_keys(n, vector<dpf_key_type>(2));
+    for(size_t i = 0;i < n;i++) {
+        // CHECK: target_index in [0, domain_size)
+        assert(domain_size == 0 || target_indices[i] < domain_size);
+        initialize_roots(dpf_keys[i][0], dpf_keys[i][1]);
+        dpf_keys[i][0].final_cw.resize(leaf_lanes);
+        dpf_keys[i][1].final_cw.resize(leaf_lanes);
+    }
+
+    size_t batches = (n + KEYGEN_BATCH - 1) / KEYGEN_BATCH;
+    pool.parallel_for(batches, [&](size_t batch, size_t) {
+        size_t begin = batch * KEYGEN_BATCH;
+        size_t pairs = min(KEYGEN_BATCH, n - begin);
+
+        dpf_tree* trees[2 * KEYGEN_BATCH] = {};
+        uint64_t target_leaves[KEYGEN_BATCH] = {};
+        for(size_t i = 0;i < pairs;i++) {
+            trees[2 * i] = &dpf_keys[begin + i][0];
+            trees[2 * i + 1] = &dpf_keys[begin + i][1];
+            target_leaves[i] = target_indices[begin + i] >> lanes_log;
+        }
+
+        int64_t seeds[2 * KEYGEN_BATCH];
+        uint8_t flags[2 * KEYGEN_BATCH];
+        generate_trees(trees, pairs, max_depth, target_leaves, seeds, flags);
+        for(size_t i = 0;i < pairs;i++) {
+            uint64_t target_lane = target_indices[begin + i] & (leaf_lanes - 1);
+            set_final_cw(dpf_keys[begin + i][0], dpf_keys[begin + i][1], seeds + 2 * i, target_lane, target_values[begin + i]);
+        }
+    });
+    return dpf_keys;
+}
+
+/*
+A function that generates arithmetic DPF keys for two parties given the domain size, target index,
+the payload vector and the output ring. The outputs of both keys add up in the ring to the payload
+at target_index and to the zero vector at every other index.
+It returns a vector of size 2 containing the DPF keys for both parties.
+*/
+vector<arithmetic_dpf_key_type> generateArithmeticDPF(uint64_t domain_size, uint64_t target_index, span<const int64_t> payload, output_ring ring) {
+
+    // CHECK: target_index in [0, domain_size)
+    assert(domain_size == 0 || target_index < domain_size);
+
+    // CHECK: the payload is not empty
+    assert(!payload.empty());
+
+    vector<arithmetic_dpf_key_type> dpf_keys(2);
+    int64_t seed[2];
+    uint8_t flag[2];
+    generate_tree(dpf_keys[0], dpf_keys[1], dpf_depth(domain_size), target_index, seed, flag);
+
+    // Expand the target leaf of both trees into ring elements
+    size_t k = payload.size();
+    vector<int64_t> expanded[2] = {vector<int64_t>(k), vector<int64_t>(k)};
+    expand_seed(seed[0], expanded[0].data(), k);
+    expand_seed(seed[1], expanded[1].data(), k);
+
+    // At the target the output is (-1)^t1 * (G(s0) - G(s1) + (t0 - t1) * final_cw), so the final correction
+    // word is (-1)^t1 * (payload - G(s0) + G(s1)), where G is the expansion of a seed into the ring
+    vector<int64_t> final_cw(k);
+    for(size_t j = 0;j < k;j++) {
+        int64_t g0 = ring_reduce(ring, expanded[0][j]);
+        int64_t g1 = ring_reduce(ring, expanded[1][j]);
+        int64_t value = ring_add(ring, ring_add(ring, ring_reduce(ring, payload[j]), ring_negate(ring, g0)), g1);
+        final_cw[j] = flag[1] ? ring_negate(ring, value) : value;
+    }
+
+    for(int b = 0;b < 2;b++) {
+        dpf_keys[b].party = b;
+        dpf_keys[b].ring = ring;
+        dpf_keys[b].final_cw = final_cw;
+    }
+    return dpf_keys;
+}
+
+/*
+A function that expands the subtree below one node of a DPF tree in place.
+On entry out[0] and flags[0] hold the seed and flag of a node at depth start_layer. On return
+out[0..2^levels) and flags[0..2^levels) hold its descendants `levels` layers further down.
+Each layer is expanded from the highest index down, so a node is read before its children
+overwrite it, and the seeds are fed to the PRG a chunk at a time.
+*/
+void expand_subtree(const dpf_tree& tree, int start_layer, int levels, int64_t* out, uint8_t* flags) {
+    const int64_t CHUNK = 8;
+    for(int l = 0;l < levels;l++) {
+        int layer = start_layer + l;
+        int64_t cw = tree.cw[layer];
+        uint8_t fcw0 = tree.fcw0[layer], fcw1 = tree.fcw1[layer];
+
+        // CHECK: flags should be either 0 or 1
+        assert(fcw0 <= 1 && fcw1 <= 1);
+
+        int64_t n = int64_t(1) << l;
+        for(int64_t end = n;end > 0;end -= CHUNK) {
+            int64_t begin = max<int64_t>(end - CHUNK, 0);
+            int64_t count = end - begin;
+
+            int64_t parents[CHUNK], children[2 * CHUNK];
+            uint8_t parent_flags[CHUNK];
+            for(int64_t j = 0;j < count;j++) {
+                parents[j] = out[begin + j];
+                parent_flags[j] = flags[begin + j];
+            }
+            length_doubling_PRG(parents, children, count);
+
+            for(int64_t j = 0;j < count;j++) {
+                int64_t left = children[2 * j], right = children[2 * j + 1];
+                uint8_t left_flag = left & 1, right_flag = right & 1;
+                if(parent_flags[j]) {
+                    left = left ^ cw;
+                    right = right ^ cw;
+                    left_flag = left_flag ^ fcw0;
+                    right_flag = right_flag ^ fcw1;
+                }
+                out[2 * (begin + j)] = left;
+                out[2 * (begin + j) + 1] = right;
+                flags[2 * (begin + j)] = left_flag;
+                flags[2 * (begin + j) + 1] = right_flag;
+            }
+        }
+    }
+}
+
+/*
+A function that turns n leaves into their outputs in place.
+On entry out[0..n) and flags[0..n) hold the leaf seeds and flags. On return out[0..n * lanes) holds
+the lanes of the leaves with the final correction words applied, and flags[0..n * lanes) the flag of
+the leaf of each output. The leaves are expanded from the highest index down, so a seed is read
+before the lanes of other leaves overwrite it.
+*/
+void expand_leaves(const dpf_key_type& dpf_key, int64_t* out, uint8_t* flags, int64_t n) {
+    const int64_t CHUNK = 8;
+    int64_t lanes = dpf_key.final_cw.size();
+    if(lanes > 1) {
+        for(int64_t end = n;end > 0;end -= CHUNK) {
+            int64_t begin = max<int64_t>(end - CHUNK, 0);
+            int64_t count = end - begin;
+
+            int64_t seeds[CHUNK];
+            uint8_t leaf_flags[CHUNK];
+            for(int64_t j = 0;j < count;j++) {
+                seeds[j] = out[begin + j];
+                leaf_flags[j] = flags[begin + j];
+            }
+            expand_seeds(seeds, out + begin * lanes, count, lanes);
+            for(int64_t j = 0;j < count;j++) {
+                fill(flags + (begin + j) * lanes, flags + (begin + j + 1) * lanes, leaf_flags[j]);
+            }
+        }
+    }
+    for(int64_t i = 0;i < n * lanes;i++) {
+        if(flags[i]) {
+            out[i] = out[i] ^ dpf_key.final_cw[i & (lanes - 1)];
+        }
+    }
+}
+
+/*
+A function that returns the output of one lane of a leaf given its seed and flag.
+*/
+int64_t leaf_output(const dpf_key_type& dpf_key, int64_t seed, uint8_t flag, uint64_t lane) {
+    int64_t value = seed;
+    if(dpf_key.final_cw.size() > 1) {
+        int64_t block[2];
+        prg::mmo(&seed, 1 + lane / 2, block, 1);
+        value = block[lane & 1];
+    }
+    return flag ? value ^ dpf_key.final_cw[lane] : value;
+}
+
+/*
+A function that turns the PRG words expanded from the seed of a leaf into the share of the payload
+of the leaf in place: the words are reduced into the ring, the final correction word is added if
+the flag is set, and the result is negated for party 1.
+*/
+void finish_payload(const arithmetic_dpf_key_type& dpf_key, uint8_t flag, int64_t* payload) {
+    output_ring ring = dpf_key.ring;
+    for(size_t j = 0;j < dpf_key.final_cw.size();j++) {
+        int64_t value = ring_reduce(ring, payload[j]);
+        if(flag) {
+            value = ring_add(ring, value, dpf_key.final_cw[j]);
+        }
+        payload[j] = dpf_key.party ? ring_negate(ring, value) : value;
+    }
+}
+
+/*
+A function that turns n leaves of an arithmetic DPF into their payloads in place.
+On entry out[0..n) and flags[0..n) hold the leaf seeds and flags. On return out[0..n * k) holds
+the shares of the payloads of the leaves one after another, and flags[0..n * k) the flag of the
+leaf of each element. Like expand_leaves it works from the highest index down.
+*/
+void expand_payloads(const arithmetic_dpf_key_type& dpf_key, int64_t* out, uint8_t* flags, int64_t n) {
+    const int64_t CHUNK = 8;
+    int64_t k = dpf_key.final_cw.size();
+    for(int64_t end = n;end > 0;end -= CHUNK) {
+        int64_t begin = max<int64_t>(end - CHUNK, 0);
+        int64_t count = end - begin;
+
+        int64_t seeds[CHUNK];
+        uint8_t leaf_flags[CHUNK];
+        for(int64_t j = 0;j < count;j++) {
+            seeds[j] = out[begin + j];
+            leaf_flags[j] = flags[begin + j];
+        }
+        expand_seeds(seeds, out + begin * k, count, k);
+        for(int64_t j = count - 1;j >= 0;j--) {
+            finish_payload(dpf_key, leaf_flags[j], out + (begin + j) * k);
+            fill(flags + (begin + j) * k, flags + (begin + j + 1) * k, leaf_flags[j]);
+        }
+    }
+}
+
+/*
+A function that evaluates a DPF key at every index of the domain and returns the resulting vector.
+The top layers of the tree are expanded on the calling thread until there are a few subtrees
+per thread of the pool. The workers then expand the subtrees and write their leaves directly
+into their slice of the result.
+*/
+vector<int64_t> EvalFull(uint64_t domain_size, const dpf_key_type& dpf_key, thread_pool& pool){
+    // CHECK: the domain fits in memory
+    assert(domain_size != 0 && dpf_depth(domain_size) < 48);
+    int max_depth = dpf_key.cw.size();
+    int64_t lanes = dpf_key.final_cw.size();
+
+    // Expand the top layers
+    int top_levels = 0;
+    while(top_levels < max_depth && (int64_t(1) << top_levels) < 4 * (int64_t)pool.size()) {
+        top_levels++;
+    }
+    vector<int64_t> top_seeds(int64_t(1) << top_levels);
+    vector<uint8_t> top_flags(int64_t(1) << top_levels);
+    top_seeds[0] = dpf_key.root;
+    top_flags[0] = dpf_key.flag;
+    expand_subtree(dpf_key, 0, top_levels, top_seeds.data(), top_flags.data());
+
+    // Expand the subtrees, the last subtree with leaves in the domain may be cut by the domain size
+    int subtree_levels = max_depth - top_levels;
+    int64_t subtree_size = int64_t(1) << subtree_levels;
+    int64_t subtree_outputs = subtree_size * lanes;
+    vector<int64_t> result(domain_size);
+    vector<vector<uint8_t>> flags(pool.size());
+    vector<vector<int64_t>> partial(pool.size());
+
+    pool.parallel_for(top_seeds.size(), [&](size_t subtree, size_t worker) {
+        uint64_t begin = subtree * subtree_outputs;
+        if(begin >= domain_size) {
+            return;
+        }
+        flags[worker].resize(subtree_outputs);
+        bool whole = begin + subtree_outputs <= domain_size;
+        if(!whole) {
+            partial[worker].resize(subtree_outputs);
+        }
+        int64_t* out = whole ? result.data() + begin : partial[worker].data();
+        out[0] = top_seeds[subtree];
+        flags[worker][0] = top_flags[subtree];
+        expand_subtree(dpf_key, top_levels, subtree_levels, out, flags[worker].data());
+        expand_leaves(dpf_key, out, flags[worker].data(), subtree_size);
+        if(!whole) {
+            copy(out, out + (domain_size - begin), result.data() + begin);
+        }
+    });
+    return result;
+}
+
+/*
+A depth-first evaluator of a DPF key that produces the outputs a block at a time, in order.
+It walks the top of the tree with an explicit stack holding the corrected children of the
+node at each depth of the current path, so every internal node is expanded exactly once, and
+expands each block of 2^block_levels leaves in place in a small buffer that stays in cache.
+All buffers are allocated by the constructor (and by reset() for a deeper tree or larger leaves
+than before), so one evaluator can be reused across keys without allocating.
+*/
+class dpf_block_evaluator {
+public:
+    explicit dpf_block_evaluator(int block_levels = 10)
+        : block_levels(block_levels), leaves(int64_t(1) << block_levels), leaf_flags(int64_t(1) << block_levels) {}
+
+    // Start evaluating a key over [0, domain_size)
+    void reset(const dpf_key_type& key, uint64_t domain_size) {
+        reset(key, 0, domain_size - 1);
+    }
+
+    // Start evaluating a key over the indices [lo, hi]
+    void reset(const dpf_key_type& key, uint64_t lo, uint64_t hi) {
+        dpf_key = &key;
+        arithmetic_key = nullptr;
+        start(key, lo, hi, __builtin_ctzll(key.final_cw.size()), 1);
+    }
+
+    // Start evaluating an arithmetic key over [0, domain_size), the block of outputs then holds
+    // the payloads of the indices one after another
+    void reset(const arithmetic_dpf_key_type& key, uint64_t domain_size) {
+        reset(key, 0, domain_size - 1);
+    }
+
+    void reset(const arithmetic_dpf_key_type& key, uint64_t lo, uint64_t hi) {
+        dpf_key = nullptr;
+        arithmetic_key = &key;
+        start(key, lo, hi, 0, key.final_cw.size());
+    }
+
+    // Expand the next block. Returns false once the whole range has been produced.
+    // The first and the last block are cut to the range.
+    bool next(uint64_t& first_index, span<const int64_t>& block, span<const uint8_t>& block_flags) {
+        if(done) {
+            return false;
+        }
+        uint64_t block_size = uint64_t(1) << (levels + lanes_log);
+        first_index = next_block * block_size;
+
+        // Walk down from the deepest node shared with the path of the previous block,
+        // or from the root for the first block of the range
+        node current;
+        int depth;
+        if(first_block) {
+            current = {tree->root, tree->flag};
+            depth = 0;
+        } else {
+            int diverge = top_depth - 1 - __builtin_ctzll(next_block);
+            current = children[diverge][1];
+            depth = diverge + 1;
+        }
+        for(;depth < top_depth;depth++) {
+            expand_node(current, depth, children[depth]);
+            int side = (next_block >> (top_depth - depth - 1)) & 1;
+            current = children[depth][side];
+        }
+
+        leaves[0] = current.seed;
+        leaf_flags[0] = current.flag;
+        expand_subtree(*tree, top_depth, levels, leaves.data(), leaf_flags.data());
+        if(dpf_key) {
+            expand_leaves(*dpf_key, leaves.data(), leaf_flags.data(), int64_t(1) << levels);
+        } else {
+            expand_payloads(*arithmetic_key, leaves.data(), leaf_flags.data(), int64_t(1) << levels);
+        }
+
+        // Compare against the last index, since the end of a 2^64 domain does not fit in 64 bits
+        uint64_t skip = first_block ? first_index_of_range - first_index : 0;
+        uint64_t count = min(block_size - 1, last_index - first_index) + 1 - skip;
+        first_index += skip;
+        block = span<const int64_t>(leaves.data() + skip * words, count * words);
+        block_flags = span<const uint8_t>(leaf_flags.data() + skip * words, count * words);
+        done = first_index + (count - 1) == last_index;
+        first_block = false;
+        next_block++;
+        return true;
+    }
+
+    // Number of indices in a block, all blocks but the last one are full
+    uint64_t block_size() const {
+        return uint64_t(1) << (levels + lanes_log);
+    }
+
+private:
+    struct node {
+        int64_t seed;
+        uint8_t flag;
+    };
+
+    // Each leaf holds 2^lanes_log indices and each index `words` outputs
+    void start(const dpf_tree& key, uint64_t lo, uint64_t hi, int lanes_log, int64_t words) {
+        assert(lo <= hi);
+        tree = &key;
+        this->lanes_log = lanes_log;
+        this->words = words;
+        first_index_of_range = lo;
+        last_index = hi;
+        done = false;
+        first_block = true;
+        max_depth = key.cw.size();
+        levels = min(block_levels, max_depth);
+        top_depth = max_depth - levels;
+        if((int)children.size() < top_depth) {
+            children.resize(top_depth);
+        }
+        size_t outputs = (size_t(1) << (levels + lanes_log)) * words;
+        if(leaves.size() < outputs) {
+            leaves.resize(outputs);
+            leaf_flags.resize(outputs);
+        }
+        // Only the blocks that overlap [lo, hi] are expanded
+        next_block = lo >> (levels + lanes_log);
+    }
+
+    // Compute the corrected children of a node at the given depth
+    void expand_node(node parent, int depth, array<node, 2>& out) const {
+        int64_t left, right;
+        length_doubling_PRG(parent.seed, left, right);
+        out[0] = {left, uint8_t(left & 1)};
+        out[1] = {right, uint8_t(right & 1)};
+        if(parent.flag) {
+            out[0].seed ^= tree->cw[depth];
+            out[1].seed ^= tree->cw[depth];
+            out[0].flag ^= tree->fcw0[depth];
+            out[1].flag ^= tree->fcw1[depth];
+        }
+    }
+
+    int block_levels;
+    vector<int64_t> leaves;
+    vector<uint8_t> leaf_flags;
+    vector<array<node, 2>> children;
+
+    const dpf_tree* tree = nullptr;
+    const dpf_key_type* dpf_key = nullptr;
+    const arithmetic_dpf_key_type* arithmetic_key = nullptr;
+    uint64_t first_index_of_range = 0, last_index = 0;
+    bool done = true, first_block = true;
+    int max_depth = 0, lanes_log = 0, levels = 0, top_depth = 0;
+    int64_t words = 1;
+    uint64_t next_block = 0;
+};
+
+/*
+A function that evaluates a DPF key at every index of the domain depth-first and passes the
+outputs to emit(first_index, outputs, flags) one block at a time, without materializing the domain.
+The key is either a dpf_key_type or an arithmetic_dpf_key_type.
+*/
+template <typename Key, typename Callback>
+void EvalFullBlocks(uint64_t domain_size, const Key& dpf_key, dpf_block_evaluator& evaluator, Callback&& emit) {
+    evaluator.reset(dpf_key, domain_size);
+    uint64_t first_index;
+    span<const int64_t> block;
+    span<const uint8_t> block_flags;
+    while(evaluator.next(first_index, block, block_flags)) {
+        emit(first_index, block, block_flags);
+    }
+}
+
+/*
+A function that evaluates a DPF key at every index of the domain into a caller supplied buffer
+of domain_size outputs, without allocating.
+*/
+void EvalFull(uint64_t domain_size, const dpf_key_type& dpf_key, dpf_block_evaluator& evaluator, span<int64_t> output) {
+    assert(domain_size != 0 && output.size() >= domain_size);
+    EvalFullBlocks(domain_size, dpf_key, evaluator, [&](uint64_t first_index, span<const int64_t> block, span<const uint8_t>) {
+        copy(block.begin(), block.end(), output.begin() + first_index);
+    });
+}
+
+/*
+Single threaded version of EvalFull.
+*/
+vector<int64_t> EvalFull(uint64_t domain_size, const dpf_key_type& dpf_key){
+    dpf_block_evaluator evaluator;
+    vector<int64_t> result(domain_size);
+    EvalFull(domain_size, dpf_key, evaluator, result);
+    return result;
+}
+
+/*
+A function that evaluates an arithmetic DPF key at every index of the domain into a caller supplied
+buffer of domain_size * k ring elements, the share of the payload of index i being at [i * k, (i + 1) * k).
+*/
+void EvalFull(uint64_t domain_size, const arithmetic_dpf_key_type& dpf_key, dpf_block_evaluator& evaluator, span<int64_t> output) {
+    size_t k = dpf_key.final_cw.size();
+    assert(domain_size != 0 && output.size() >= domain_size * k);
+    EvalFullBlocks(domain_size, dpf_key, evaluator, [&](uint64_t first_index, span<const int64_t> block, span<const uint8_t>) {
+        copy(block.begin(), block.end(), output.begin() + first_index * k);
+    });
+}
+
+vector<int64_t> EvalFull(uint64_t domain_size, const arithmetic_dpf_key_type& dpf_key){
+    dpf_block_evaluator evaluator;
+    vector<int64_t> result(domain_size * dpf_key.final_cw.size());
+    EvalFull(domain_size, dpf_key, evaluator, result);
+    return result;
+}
+
+/*
+A function that evaluates a DPF key at the indices [lo, hi] only and passes the outputs to
+emit(first_index, outputs, flags) one block at a time. Only the subtrees covering the range are
+expanded, so a server holding a shard of the domain pays for its shard and not for the whole domain.
+*/
+template <typename Key, typename Callback>
+void EvalRangeBlocks(const Key& dpf_key, uint64_t lo, uint64_t hi, dpf_block_evaluator& evaluator, Callback&& emit) {
+    evaluator.reset(dpf_key, lo, hi);
+    uint64_t first_index;
+    span<const int64_t> block;
+    span<const uint8_t> block_flags;
+    while(evaluator.next(first_index, block, block_flags)) {
+        emit(first_index, block, block_flags);
+    }
+}
+
+/*
+A function that evaluates a DPF key at the indices [lo, hi] into a caller supplied buffer of
+hi - lo + 1 outputs (times the payload length for an arithmetic key), output[0] being index lo.
+*/
+template <typename Key>
+void EvalRange(const Key& dpf_key, uint64_t lo, uint64_t hi, dpf_block_evaluator& evaluator, span<int64_t> output) {
+    size_t k = is_same_v<Key, dpf_key_type> ? 1 : dpf_key.final_cw.size();
+    assert(lo <= hi && output.size() >= (hi - lo + 1) * k);
+    EvalRangeBlocks(dpf_key, lo, hi, evaluator, [&](uint64_t first_index, span<const int64_t> block, span<const uint8_t>) {
+        copy(block.begin(), block.end(), output.begin() + (first_index - lo) * k);
+    });
+}
+
+vector<int64_t> EvalRange(const dpf_key_type& dpf_key, uint64_t lo, uint64_t hi) {
+    dpf_block_evaluator evaluator;
+    vector<int64_t> result(hi - lo + 1);
+    EvalRange(dpf_key, lo, hi, evaluator, span<int64_t>(result));
+    return result;
+}
+
+vector<int64_t> EvalRange(const arithmetic_dpf_key_type& dpf_key, uint64_t lo, uint64_t hi) {
+    dpf_block_evaluator evaluator;
+    vector<int64_t> result((hi - lo + 1) * dpf_key.final_cw.size());
+    EvalRange(dpf_key, lo, hi, evaluator, span<int64_t>(result));
+    return result;
+}
+
+/*
+A function that moves from a node at the given depth to its child on the given side (0 for left, 1 for right),
+applying the correction words of the layer when the parent flag is set.
+*/
+void descend(const dpf_tree& tree, int depth, int side, int64_t& seed, uint8_t& flag) {
+    int64_t children[2];
+    length_doubling_PRG(seed, children[0], children[1]);
+    int64_t child = children[side];
+    uint8_t child_flag = child & 1;
+    if(flag) {
+        child ^= tree.cw[depth];
+        child_flag ^= side ? tree.fcw1[depth] : tree.fcw0[depth];
+    }
+    seed = child;
+    flag = child_flag;
+}
+
+/*
+A function that evaluates a DPF key at a single index by walking only the root-to-leaf path,
+which costs one PRG call per layer.
+*/
+int64_t Eval(const dpf_key_type& dpf_key, uint64_t index) {
+    int max_depth = dpf_key.cw.size();
+    int lanes_log = __builtin_ctzll(dpf_key.final_cw.size());
+    uint64_t leaf = index >> lanes_log;
+    int64_t seed = dpf_key.root;
+    uint8_t flag = dpf_key.flag;
+    for(int depth = 0;depth < max_depth;depth++) {
+        descend(dpf_key, depth, (leaf >> (max_depth - depth - 1)) & 1, seed, flag);
+    }
+    return leaf_output(dpf_key, seed, flag, index & (dpf_key.final_cw.size() - 1));
+}
+
+/*
+A function that evaluates a serialized DPF key at a single index in place, without copying the key.
+*/
+int64_t Eval(const dpf_key_view& dpf_key, uint64_t index) {
+    int max_depth = dpf_key.depth();
+    size_t lanes = dpf_key.final_words();
+    uint64_t leaf = index >> __builtin_ctzll(lanes);
+    int64_t seed = dpf_key.root();
+    uint8_t flag = dpf_key.flag();
+    for(int depth = 0;depth < max_depth;depth++) {
+        int side = (leaf >> (max_depth - depth - 1)) & 1;
+        int64_t children[2];
+        length_doubling_PRG(seed, children[0], children[1]);
+        int64_t child = children[side];
+        uint8_t child_flag = child & 1;
+        if(flag) {
+            child ^= dpf_key.cw(depth);
+            child_flag ^= side ? dpf_key.fcw1(depth) : dpf_key.fcw0(depth);
+        }
+        seed = child;
+        flag = child_flag;
+    }
+
+    uint64_t lane = index & (lanes - 1);
+    int64_t value = seed;
+    if(lanes > 1) {
+        int64_t block[2];
+        prg::mmo(&seed, 1 + lane / 2, block, 1);
+        value = block[lane & 1];
+    }
+    return flag ? value ^ dpf_key.final_cw()[lane] : value;
+}
+
+/*
+A function that evaluates a DPF key at a batch of indices sorted in ascending order.
+The path of each index is only walked below the deepest node it shares with the previous index,
+so nearby indices share most of their PRG calls. Uses O(log N) memory besides the outputs.
+*/
+void EvalPoints(const dpf_key_type& dpf_key, span<const uint64_t> indices, span<int64_t> output) {
+    assert(output.size() >= indices.size());
+    assert(is_sorted(indices.begin(), indices.end()));
+    int max_depth = dpf_key.cw.size();
+    int lanes_log = __builtin_ctzll(dpf_key.final_cw.size());
+
+    // path_seeds[d] and path_flags[d] hold the node at depth d on the path of the previous index
+    vector<int64_t> path_seeds(max_depth + 1);
+    vector<uint8_t> path_flags(max_depth + 1);
+    path_seeds[0] = dpf_key.root;
+    path_flags[0] = dpf_key.flag;
+
+    for(size_t i = 0;i < indices.size();i++) {
+        uint64_t leaf = indices[i] >> lanes_log;
+        int depth = 0;
+        if(i > 0) {
+            uint64_t diff = (indices[i - 1] >> lanes_log) ^ leaf;
+            depth = diff == 0 ? max_depth : max_depth - (64 - __builtin_clzll(diff));
+        }
+        for(;depth < max_depth;depth++) {
+            path_seeds[depth + 1] = path_seeds[depth];
+            path_flags[depth + 1] = path_flags[depth];
+            descend(dpf_key, depth, (leaf >> (max_depth - depth - 1)) & 1, path_seeds[depth + 1], path_flags[depth + 1]);
+        }
+        output[i] = leaf_output(dpf_key, path_seeds[max_depth], path_flags[max_depth], indices[i] & (dpf_key.final_cw.size() - 1));
+    }
+}
+
+/*
+A function that evaluates an arithmetic DPF key at a single index into the k elements of output.
+*/
+void Eval(const arithmetic_dpf_key_type& dpf_key, uint64_t index, span<int64_t> output) {
+    assert(output.size() >= dpf_key.final_cw.size());
+    int max_depth = dpf_key.cw.size();
+    int64_t seed = dpf_key.root;
+    uint8_t flag = dpf_key.flag;
+    for(int depth = 0;depth < max_depth;depth++) {
+        descend(dpf_key, depth, (index >> (max_depth - depth - 1)) & 1, seed, flag);
+    }
+    expand_seed(seed, output.data(), dpf_key.final_cw.size());
+    finish_payload(dpf_key, flag, output.data());
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/*
+A structure to hold the tree of a DPF key, shared by all kinds of DPF keys.
+- root: The root seed of the DPF tree.
+- flag: The flag associated with the root seed.
+- cw: A vector of correction words for each layer of the DPF tree.
+- fcw0: A vector of flag correction words for the left children in a layer.
+- fcw1: A vector of flag correction words for the right children in a layer.
+Since the flag correction words depend only on the side of a child, a key can be evaluated
+without knowing the target index.
+*/
+struct dpf_tree {
+    int64_t root;
+    uint8_t flag;
+    std::vector<int64_t> cw;
+    std::vector<uint8_t> fcw0;
+    std::vector<uint8_t> fcw1;
+};
+
+/*
+A structure to hold a DPF key whose outputs are XOR shares.
+- final_cw: The correction words XORed into the lanes of the leaves whose flag is set.
+Each leaf of the tree holds final_cw.size() consecutive outputs (its lanes, a power of 2). With more
+than one lane the leaf seed is expanded into the lanes by the PRG, which saves the last layers of the tree.
+*/
+struct dpf_key_type : dpf_tree {
+    std::vector<int64_t> final_cw;
+};
+
+/*
+The ring of the outputs of an arithmetic DPF: 64-bit integers with wraparound, or integers modulo PRIME (2^61 - 1).
+*/
+enum output_ring : uint8_t {
+    RING_2_64 = 0,
+    RING_PRIME = 1
+};
+
+/*
+A structure to hold a DPF key whose outputs are additive shares of a vector over a ring.
+- party: 0 or 1, the output of party 1 is negated so that the outputs of both parties add up.
+- ring: The ring of the outputs.
+- final_cw: The correction word added to the payload of the leaves whose flag is set, one element
+  per element of the payload.
+Each index of the domain is a leaf whose seed is expanded into a payload of final_cw.size() elements.
+*/
+struct arithmetic_dpf_key_type : dpf_tree {
+    uint8_t party;
+    output_ring ring;
+    std::vector<int64_t> final_cw;
+};
@@ -0,0 +1,338 @@
+#pragma once
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dpf_key.hpp"
+
+/*
+Binary format of DPF keys, version 1. Everything is a 64-bit little-endian word, so serialized
+keys can be used in place once they are in memory, for example from a memory mapped key file.
+
+Header (KEY_HEADER_WORDS words):
+  0: magic "DPFKEYS\0"
+  1: version (bits 0-31), kind of the keys (bits 32-39), ring of arithmetic keys (bits 40-47)
+  2: depth of the trees
+  3: number of final correction words per key (lanes of a leaf, or length of the payload)
+  4: number of keys
+Then the keys one after another, each taking dpf_key_words(depth, final_words) words:
+  root
+  flag (bits 0-7), party of arithmetic keys (bits 8-15)
+  cw[0..depth)
+  ceil(2 * depth / 64) words of flag correction bits: bit 2d is fcw0[d], bit 2d + 1 is fcw1[d]
+  final_cw[0..final_words)
+A single serialized key is a key file holding one key. All keys of a file have the same layout,
+so key i is found at a fixed offset without parsing the keys before it.
+*/
+// The words are written and read in the byte order of the host, which is therefore required to be little-endian
+static_assert(std::endian::native == std::endian::little, "the DPF key format is little-endian");
+
+const uint64_t KEY_MAGIC = 0x005359454b465044; // "DPFKEYS\0"
+const uint32_t KEY_FORMAT_VERSION = 1;
+const size_t KEY_HEADER_WORDS = 5;
+
+enum key_kind : uint8_t {
+    KEY_XOR = 0,
+    KEY_ARITHMETIC = 1
+};
+
+struct key_header {
+    key_kind kind;
+    output_ring ring;
+    int depth;
+    size_t final_words;
+    size_t count;
+};
+
+inline size_t dpf_key_words(int depth, size_t final_words) {
+    return 2 + depth + (2 * depth + 63) / 64 + final_words;
+}
+
+inline void write_key_header(const key_header& header, uint64_t* out) {
+    out[0] = KEY_MAGIC;
+    out[1] = KEY_FORMAT_VERSION | (uint64_t(header.kind) << 32) | (uint64_t(header.ring) << 40);
+    out[2] = header.depth;
+    out[3] = header.final_words;
+    out[4] = header.count;
+}
+
+// Reads and validates the header of serialized keys, throws std::runtime_error if they are malformed
+inline key_header read_key_header(std::span<const uint64_t> words) {
+    if (words.size() < KEY_HEADER_WORDS || words[0] != KEY_MAGIC) {
+        throw std::runtime_error("not a DPF key file");
+    }
+    if ((uint32_t)words[1] != KEY_FORMAT_VERSION) {
+        throw std::runtime_error("unsupported DPF key format version " + std::to_string((uint32_t)words[1]));
+    }
+    key_header header;
+    header.kind = key_kind((words[1] >> 32) & 0xff);
+    header.ring = output_ring((words[1] >> 40) & 0xff);
+    if (header.kind > KEY_ARITHMETIC || header.ring > RING_PRIME || words[2] > 64 || words[3] == 0) {
+        throw std::runtime_error("malformed DPF key header");
+    }
+    // The lanes of an XOR key are indexed with index & (lanes - 1) below the depth of the tree
+    if (header.kind == KEY_XOR && (!std::has_single_bit(words[3]) || words[2] + std::countr_zero(words[3]) > 64)) {
+        throw std::runtime_error("malformed DPF key header: the lanes of a leaf must be a power of 2 and the domain at most 2^64");
+    }
+    header.depth = words[2];
+    header.final_words = words[3];
+    header.count = words[4];
+    // depth and final_words are bounded by the words of the file first, so that the key size
+    // cannot overflow, and the key size is at least 2, so that the division is defined
+    size_t available = words.size() - KEY_HEADER_WORDS;
+    if (words[2] > available || words[3] > available) {
+        throw std::runtime_error("truncated DPF key file");
+    }
+    if (header.count > available / dpf_key_words(header.depth, header.final_words)) {
+        throw std::runtime_error("truncated DPF key file");
+    }
+    return header;
+}
+
+// Writes the words of one key
+inline void write_key(const dpf_tree& key, uint8_t party, const std::vector<int64_t>& final_cw, uint64_t* out) {
+    int depth = key.cw.size();
+    out[0] = key.root;
+    out[1] = key.flag | (uint64_t(party) << 8);
+    memcpy(out + 2, key.cw.data(), depth * sizeof(int64_t));
+    uint64_t* fcw = out + 2 + depth;
+    memset(fcw, 0, (2 * depth + 63) / 64 * sizeof(uint64_t));
+    for (int d = 0; d < depth; d++) {
+        fcw[2 * d / 64] |= uint64_t(key.fcw0[d]) << (2 * d % 64);
+        fcw[2 * d / 64] |= uint64_t(key.fcw1[d]) << (2 * d % 64 + 1);
+    }
+    memcpy(fcw + (2 * depth + 63) / 64, final_cw.data(), final_cw.size() * sizeof(int64_t));
+}
+
+/*
+A read-only view of one serialized key. Nothing is copied: the accessors read the serialized words.
+*/
+class dpf_key_view {
+public:
+    dpf_key_view(const uint64_t* words, int depth, size_t final_words)
+        : words(words), key_depth(depth), key_final_words(final_words) {}
+
+    int depth() const { return key_depth; }
+    size_t final_words() const { return key_final_words; }
+
+    int64_t root() const { return words[0]; }
+    uint8_t flag() const { return words[1] & 0xff; }
+    uint8_t party() const { return (words[1] >> 8) & 0xff; }
+    int64_t cw(int layer) const { return words[2 + layer]; }
+    uint8_t fcw0(int layer) const { return (fcw_bits()[2 * layer / 64] >> (2 * layer % 64)) & 1; }
+    uint8_t fcw1(int layer) const { return (fcw_bits()[2 * layer / 64] >> (2 * layer % 64 + 1)) & 1; }
+    std::span<const int64_t> final_cw() const {
+        return {(const int64_t*)fcw_bits() + (2 * key_depth + 63) / 64, key_final_words};
+    }
+
+    // Copies the key into an owning key, reusing the memory the key already holds
+    void copy_to(dpf_key_type& key) const {
+        copy_tree(key);
+        key.final_cw.assign(final_cw().begin(), final_cw().end());
+    }
+
+    void copy_to(arithmetic_dpf_key_type& key, output_ring ring) const {
+        copy_tree(key);
+        key.party = party();
+        key.ring = ring;
+        key.final_cw.assign(final_cw().begin(), final_cw().end());
+    }
+
+private:
+    const uint64_t* fcw_bits() const { return words + 2 + key_depth; }
+
+    void copy_tree(dpf_tree& key) const {
+        key.root = root();
+        key.flag = flag();
+        key.cw.assign((const int64_t*)words + 2, (const int64_t*)words + 2 + key_depth);
+        key.fcw0.resize(key_depth);
+        key.fcw1.resize(key_depth);
+        for (int d = 0; d < key_depth; d++) {
+            key.fcw0[d] = fcw0(d);
+            key.fcw1[d] = fcw1(d);
+        }
+    }
+
+    const uint64_t* words;
+    int key_depth;
+    size_t key_final_words;
+};
+
+/*
+Serializes keys of the same kind, depth and number of final correction words into the binary format.
+*/
+template <typename Key>
+std::vector<uint64_t> serialize_keys(std::span<const Key> keys, key_kind kind, output_ring ring) {
+    if (keys.empty()) {
+        throw std::invalid_argument("no keys to serialize");
+    }
+    int depth = keys[0].cw.size();
+    size_t final_words = keys[0].final_cw.size();
+    size_t key_words = dpf_key_words(depth, final_words);
+    std::vector<uint64_t> words(KEY_HEADER_WORDS + keys.size() * key_words);
+    write_key_header({kind, ring, depth, final_words, keys.size()}, words.data());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if ((int)keys[i].cw.size() != depth || keys[i].final_cw.size() != final_words) {
+            throw std::invalid_argument("keys of a key file must have the same depth and final correction words");
+        }
+        uint8_t party = 0;
+        if constexpr (std::is_same_v<Key, arithmetic_dpf_key_type>) {
+            party = keys[i].party;
+        }
+        write_key(keys[i], party, keys[i].final_cw, words.data() + KEY_HEADER_WORDS + i * key_words);
+    }
+    return words;
+}
+
+inline std::vector<uint64_t> serialize_keys(std::span<const dpf_key_type> keys) {
+    return serialize_keys(keys, KEY_XOR, RING_2_64);
+}
+
+inline std::vector<uint64_t> serialize_keys(std::span<const arithmetic_dpf_key_type> keys) {
+    return serialize_keys(keys, KEY_ARITHMETIC, keys.empty() ? RING_2_64 : keys[0].ring);
+}
+
+inline std::vector<uint64_t> serialize_dpf_key(const dpf_key_type& key) {
+    return serialize_keys(std::span<const dpf_key_type>(&key, 1));
+}
+
+inline std::vector<uint64_t> serialize_dpf_key(const arithmetic_dpf_key_type& key) {
+    return serialize_keys(std::span<const arithmetic_dpf_key_type>(&key, 1));
+}
+
+/*
+A collection of serialized keys, either memory mapped from a key file or over words in memory.
+Keys are accessed as views in place: opening a store and iterating over it does not parse or
+allocate per key.
+*/
+class dpf_key_store {
+public:
+    // Uses serialized keys in memory, which must outlive the store
+    explicit dpf_key_store(std::span<const uint64_t> words) : words(words), header(read_key_header(words)) {}
+
+    // Memory maps a key file
+    explicit dpf_key_store(const std::string& path) : header(map_file(path)) {}
+
+    ~dpf_key_store() {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+        }
+    }
+
+    dpf_key_store(const dpf_key_store&) = delete;
+    dpf_key_store& operator=(const dpf_key_store&) = delete;
+
+    size_t size() const { return header.count; }
+    key_kind kind() const { return header.kind; }
+    output_ring ring() const { return header.ring; }
+    int depth() const { return header.depth; }
+    size_t final_words() const { return header.final_words; }
+
+    dpf_key_view operator[](size_t i) const {
+        size_t key_words = dpf_key_words(header.depth, header.final_words);
+        return dpf_key_view(words.data() + KEY_HEADER_WORDS + i * key_words, header.depth, header.final_words);
+    }
+
+    class iterator {
+    public:
+        iterator(const dpf_key_store* store, size_t i) : store(store), i(i) {}
+        dpf_key_view operator*() const { return (*store)[i]; }
+        iterator& operator++() { i++; return *this; }
+        bool operator!=(const iterator& other) const { return i != other.i; }
+    private:
+        const dpf_key_store* store;
+        size_t i;
+    };
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, size()); }
+
+private:
+    key_header map_file(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open key file " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("cannot read key file " + path);
+        }
+        mapping_size = st.st_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::runtime_error("cannot map key file " + path + ": " + strerror(errno));
+        }
+        words = std::span<const uint64_t>((const uint64_t*)mapping, mapping_size / sizeof(uint64_t));
+        try {
+            return read_key_header(words);
+        } catch (...) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+            throw;
+        }
+    }
+
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    std::span<const uint64_t> words;
+    key_header header;
+};
+
+/*
+Deserializes a single key, throws std::runtime_error if the words do not hold one key of that kind.
+*/
+inline dpf_key_type deserialize_dpf_key(std::span<const uint64_t> words) {
+    dpf_key_store store(words);
+    if (store.kind() != KEY_XOR || store.size() != 1) {
+        throw std::runtime_error("not a serialized XOR DPF key");
+    }
+    dpf_key_type key;
+    store[0].copy_to(key);
+    return key;
+}
+
+inline arithmetic_dpf_key_type deserialize_arithmetic_dpf_key(std::span<const uint64_t> words) {
+    dpf_key_store store(words);
+    if (store.kind() != KEY_ARITHMETIC || store.size() != 1) {
+        throw std::runtime_error("not a serialized arithmetic DPF key");
+    }
+    arithmetic_dpf_key_type key;
+    store[0].copy_to(key, store.ring());
+    return key;
+}
+
+/*
+Writes keys of the same kind, depth and number of final correction words to a key file.
+*/
+template <typename Key>
+void write_key_store(const std::string& path, std::span<const Key> keys) {
+    std::vector<uint64_t> words = serialize_keys(keys);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("cannot create key file " + path + ": " + strerror(errno));
+    }
+    const char* data = (const char*)words.data();
+    size_t left = words.size() * sizeof(uint64_t);
+    while (left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written < 0) {
+            close(fd);
+            throw std::runtime_error("cannot write key file " + path + ": " + strerror(errno));
+        }
+        data += written;
+        left -= written;
+    }
+    close(fd);
+}
@@ -0,0 +1,310 @@
+#pragma once
+#include <bits/stdc++.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIR_AVX2 1
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dpf.hpp"
+using namespace std;
+
+/*
+A database of fixed-size records memory mapped from a file. The file holds the records one after
+another, each record being record_words 64-bit words.
+*/
+class pir_database {
+public:
+    pir_database(const string& path, size_t record_words) : words(record_words) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            throw runtime_error("cannot open database " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % (record_words * sizeof(uint64_t)) != 0) {
+            close(fd);
+            throw runtime_error("database " + path + " is not a whole number of records");
+        }
+        mapping_size = st.st_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            throw runtime_error("cannot map database " + path + ": " + strerror(errno));
+        }
+        // The records are read once, front to back
+        madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+    }
+
+    ~pir_database() {
+        munmap(mapping, mapping_size);
+    }
+
+    pir_database(const pir_database&) = delete;
+    pir_database& operator=(const pir_database&) = delete;
+
+    uint64_t size() const { return mapping_size / (words * sizeof(uint64_t)); }
+    size_t record_words() const { return words; }
+    const uint64_t* record(uint64_t index) const { return (const uint64_t*)mapping + index * words; }
+
+private:
+    void* mapping;
+    size_t mapping_size;
+    size_t words;
+};
+
+/*
+Kernels that accumulate a block of records weighted by the DPF outputs of their indices into an answer.
+xor_accumulate XORs in the records whose selection bit (bit 0 of the output) is set, add_accumulate
+adds output * record with 64-bit wraparound. The AVX2 versions give the same results as the portable
+ones and are picked at runtime when the processor has AVX2 (they are only compiled on x86).
+*/
+void xor_accumulate_portable(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    for(size_t i = 0;i < count;i++) {
+        uint64_t mask = -(uint64_t)(outputs[i] & 1);
+        for(size_t j = 0;j < words;j++) {
+            answer[j] ^= records[i * words + j] & mask;
+        }
+    }
+}
+
+void add_accumulate_portable(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    for(size_t i = 0;i < count;i++) {
+        uint64_t weight = outputs[i];
+        for(size_t j = 0;j < words;j++) {
+            answer[j] += records[i * words + j] * weight;
+        }
+    }
+}
+
+#ifdef PIR_AVX2
+__attribute__((target("avx2")))
+void xor_accumulate_avx2(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    const __m256i one = _mm256_set1_epi64x(1);
+    if(words == 1) {
+        // Single word records: four records at a time
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        for(;i + 4 <= count;i += 4) {
+            __m256i mask = _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(outputs + i)), one));
+            sum = _mm256_xor_si256(sum, _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(records + i)), mask));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, sum);
+        answer[0] ^= lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
+        xor_accumulate_portable(answer, records + i, outputs + i, count - i, 1);
+        return;
+    }
+    for(size_t i = 0;i < count;i++) {
+        __m256i mask = _mm256_set1_epi64x(-(outputs[i] & 1));
+        const uint64_t* record = records + i * words;
+        size_t j = 0;
+        for(;j + 4 <= words;j += 4) {
+            __m256i sum = _mm256_loadu_si256((const __m256i*)(answer + j));
+            sum = _mm256_xor_si256(sum, _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(record + j)), mask));
+            _mm256_storeu_si256((__m256i*)(answer + j), sum);
+        }
+        uint64_t scalar_mask = -(uint64_t)(outputs[i] & 1);
+        for(;j < words;j++) {
+            answer[j] ^= record[j] & scalar_mask;
+        }
+    }
+}
+
+// Lane-wise 64-bit product with wraparound from 32-bit multiplications, since AVX2 has no 64-bit multiply
+__attribute__((target("avx2")))
+inline __m256i multiply_epi64(__m256i a, __m256i b) {
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+void add_accumulate_avx2(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    if(words == 1) {
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        for(;i + 4 <= count;i += 4) {
+            __m256i product = multiply_epi64(_mm256_loadu_si256((const __m256i*)(records + i)), _mm256_loadu_si256((const __m256i*)(outputs + i)));
+            sum = _mm256_add_epi64(sum, product);
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, sum);
+        answer[0] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        add_accumulate_portable(answer, records + i, outputs + i, count - i, 1);
+        return;
+    }
+    for(size_t i = 0;i < count;i++) {
+        __m256i weight = _mm256_set1_epi64x(outputs[i]);
+        const uint64_t* record = records + i * words;
+        size_t j = 0;
+        for(;j + 4 <= words;j += 4) {
+            __m256i sum = _mm256_loadu_si256((const __m256i*)(answer + j));
+            sum = _mm256_add_epi64(sum, multiply_epi64(_mm256_loadu_si256((const __m256i*)(record + j)), weight));
+            _mm256_storeu_si256((__m256i*)(answer + j), sum);
+        }
+        for(;j < words;j++) {
+            answer[j] += record[j] * (uint64_t)outputs[i];
+        }
+    }
+}
+
+inline bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#else
+// The AVX2 kernels are only compiled on x86
+void xor_accumulate_avx2(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    xor_accumulate_portable(answer, records, outputs, count, words);
+}
+
+void add_accumulate_avx2(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    add_accumulate_portable(answer, records, outputs, count, words);
+}
+
+inline bool has_avx2() {
+    return false;
+}
+#endif
+
+void xor_accumulate(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    if(has_avx2()) {
+        xor_accumulate_avx2(answer, records, outputs, count, words);
+    } else {
+        xor_accumulate_portable(answer, records, outputs, count, words);
+    }
+}
+
+void add_accumulate(uint64_t* answer, const uint64_t* records, const int64_t* outputs, size_t count, size_t words) {
+    if(has_avx2()) {
+        add_accumulate_avx2(answer, records, outputs, count, words);
+    } else {
+        add_accumulate_portable(answer, records, outputs, count, words);
+    }
+}
+
+/*
+The number of levels of the evaluation blocks, so that the records of a block (about 128KB) stay
+in the L2 cache while every key of a batch is accumulated over them.
+*/
+int pir_block_levels(size_t record_words) {
+    int levels = 4;
+    while(levels < 12 && (size_t(2) << levels) * record_words * sizeof(uint64_t) <= 128 * 1024) {
+        levels++;
+    }
+    return levels;
+}
+
+/*
+log2 of the number of indices a key covers: every leaf of an XOR key packs final_cw.size() lanes,
+an arithmetic key has one index per leaf.
+*/
+inline int key_domain_bits(const dpf_key_type& key) {
+    return key.cw.size() + bit_width(key.final_cw.size()) - 1;
+}
+
+inline int key_domain_bits(const arithmetic_dpf_key_type& key) {
+    return key.cw.size();
+}
+
+// Throws invalid_argument unless every key covers the indices [0, domain_size)
+template <typename Key>
+void check_key_domains(span<const Key> keys, uint64_t domain_size) {
+    for(const Key& key : keys) {
+        int bits = key_domain_bits(key);
+        if(bits < 64 && (uint64_t(1) << bits) < domain_size) {
+            throw invalid_argument("a DPF key covering 2^" + to_string(bits) + " indices cannot select among " + to_string(domain_size) + " records");
+        }
+    }
+}
+
+// Slices of the database per thread of the pool, so that uneven slices balance
+const uint64_t PIR_SLICES_PER_THREAD = 4;
+
+/*
+A function that answers a batch of PIR queries with a single pass over the database.
+The index range is cut into slices of whole blocks that are spread over the threads of the pool,
+so that even a single query uses every thread. Within a slice the keys are expanded depth-first
+in lock-step, one block of indices at a time, and the outputs of each block are accumulated
+against the records of the block right away, so the expanded vectors are never materialized and
+each block of records is read from memory once for the whole batch. Every thread accumulates
+into its own partial answers, which are combined at the end.
+Throws invalid_argument if a key does not cover the whole database.
+*/
+template <typename Key>
+vector<vector<uint64_t>> answer_queries(const pir_database& db, span<const Key> keys, thread_pool& pool,
+                                        void (*accumulate)(uint64_t*, const uint64_t*, const int64_t*, size_t, size_t),
+                                        uint64_t (*combine)(uint64_t, uint64_t)) {
+    size_t words = db.record_words();
+    vector<vector<uint64_t>> answers(keys.size(), vector<uint64_t>(words, 0));
+    if(keys.empty()) {
+        return answers;
+    }
+    check_key_domains(keys, db.size());
+
+    int levels = pir_block_levels(words);
+    uint64_t block_size = uint64_t(1) << levels;
+    uint64_t blocks = (db.size() + block_size - 1) / block_size;
+    uint64_t slices = min<uint64_t>(blocks, pool.size() * PIR_SLICES_PER_THREAD);
+
+    vector<vector<dpf_block_evaluator>> evaluators(pool.size());
+    vector<vector<uint64_t>> partial(pool.size(), vector<uint64_t>(keys.size() * words, 0));
+    pool.parallel_for(slices, [&](size_t slice, size_t worker) {
+        uint64_t lo = blocks * slice / slices * block_size;
+        uint64_t hi = min<uint64_t>(blocks * (slice + 1) / slices * block_size, db.size()) - 1;
+        vector<dpf_block_evaluator>& evaluator = evaluators[worker];
+        if(evaluator.empty()) {
+            evaluator.assign(keys.size(), dpf_block_evaluator(levels));
+        }
+        for(size_t q = 0;q < keys.size();q++) {
+            evaluator[q].reset(keys[q], lo, hi);
+        }
+
+        uint64_t* answer = partial[worker].data();
+        bool more = true;
+        while(more) {
+            more = false;
+            for(size_t q = 0;q < keys.size();q++) {
+                uint64_t first_index;
+                span<const int64_t> block;
+                span<const uint8_t> block_flags;
+                if(evaluator[q].next(first_index, block, block_flags)) {
+                    accumulate(answer + q * words, db.record(first_index), block.data(), block.size(), words);
+                    more = true;
+                }
+            }
+        }
+    });
+
+    for(const vector<uint64_t>& worker_answers : partial) {
+        for(size_t q = 0;q < keys.size();q++) {
+            for(size_t j = 0;j < words;j++) {
+                answers[q][j] = combine(answers[q][j], worker_answers[q * words + j]);
+            }
+        }
+    }
+    return answers;
+}
+
+/*
+XOR PIR: the keys are XOR DPF keys with target_value 1 (or any odd value), and the answers of
+both servers XOR to the record at the target index.
+*/
+vector<vector<uint64_t>> answer_queries(const pir_database& db, span<const dpf_key_type> keys, thread_pool& pool) {
+    return answer_queries(db, keys, pool, xor_accumulate, [](uint64_t a, uint64_t b) { return a ^ b; });
+}
+
+/*
+Additive PIR: the keys are arithmetic DPF keys over RING_2_64 with the payload {1}, and the answers
+of both servers add up to the record at the target index.
+*/
+vector<vector<uint64_t>> answer_queries(const pir_database& db, span<const arithmetic_dpf_key_type> keys, thread_pool& pool) {
+    for(const auto& key : keys) {
+        if(key.ring != RING_2_64 || key.final_cw.size() != 1) {
+            throw invalid_argument("additive PIR needs arithmetic keys over RING_2_64 with a payload of length 1");
+        }
+    }
+    return answer_queries(db, keys, pool, add_accumulate, [](uint64_t a, uint64_t b) { return a + b; });
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+A fixed pool of worker threads for data-parallel loops.
+parallel_for(n, task) calls task(index, worker) for every index in [0, n) and returns once
+all of them are done. The indices are handed out one at a time, so uneven tasks balance
+themselves. worker is in [0, size()) and can be used to pick per-thread scratch space.
+The calling thread takes part as worker 0.
+If a task throws, the indices not yet started are skipped, parallel_for waits until the running
+tasks have finished and then rethrows the first exception on the calling thread, whichever
+thread it was thrown on.
+*/
+class thread_pool {
+public:
+    explicit thread_pool(size_t threads = std::thread::hardware_concurrency()) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t worker = 1; worker < threads; worker++) {
+            workers.emplace_back([this, worker] { worker_loop(worker); });
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_ready.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    void parallel_for(size_t n, const std::function<void(size_t, size_t)>& task) {
+        if (workers.empty() || n <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                task(i, 0);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current_task = &task;
+            job_size = n;
+            next_index = 0;
+            busy_workers = workers.size();
+            generation++;
+        }
+        job_ready.notify_all();
+
+        run_tasks(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job_done.wait(lock, [&] { return busy_workers == 0; });
+        current_task = nullptr;
+        if (job_error) {
+            std::exception_ptr error = std::move(job_error);
+            job_error = nullptr;
+            lock.unlock();
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    // Runs tasks until the indices run out, an exception is kept for parallel_for to rethrow
+    void run_tasks(size_t worker) {
+        try {
+            while (true) {
+                size_t i = next_index.fetch_add(1);
+                if (i >= job_size) {
+                    return;
+                }
+                (*current_task)(i, worker);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job_error) {
+                job_error = std::current_exception();
+            }
+            next_index = job_size;
+        }
+    }
+
+    void worker_loop(size_t worker) {
+        size_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+            }
+            run_tasks(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy_workers--;
+            }
+            job_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable job_ready, job_done;
+    const std::function<void(size_t, size_t)>* current_task = nullptr;
+    size_t job_size = 0;
+    std::atomic<size_t> next_index{0};
+    size_t busy_workers = 0;
+    std::exception_ptr job_error;
+    size_t generation = 0;
+    bool stopping = false;
+};
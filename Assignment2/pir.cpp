@@ -0,0 +1,167 @@
+#include <bits/stdc++.h>
+#include "header_files/dpf.hpp"
+#include "header_files/pir.hpp"
+#include "header_files/batch_pir.hpp"
+using namespace std;
+
+/*
+A function that writes a database of num_records random records of record_words words to a new
+temporary file and returns its path.
+*/
+string write_random_database(uint64_t num_records, size_t record_words) {
+    char path[] = "/tmp/pir_database_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        throw runtime_error(string("cannot create database: ") + strerror(errno));
+    }
+    mt19937_64 gen(random_uint());
+    vector<uint64_t> chunk;
+    uint64_t left = num_records * record_words;
+    while(left > 0) {
+        chunk.resize(min<uint64_t>(left, 1 << 16));
+        for(auto& word : chunk) {
+            word = gen();
+        }
+        if(write(fd, chunk.data(), chunk.size() * sizeof(uint64_t)) != (ssize_t)(chunk.size() * sizeof(uint64_t))) {
+            close(fd);
+            throw runtime_error(string("cannot write database: ") + strerror(errno));
+        }
+        left -= chunk.size();
+    }
+    close(fd);
+    return path;
+}
+
+/*
+A function that answers the queries of both parties, reconstructs the records and compares them with the database.
+combine reconstructs a word from the words of the answers of both parties.
+*/
+template <typename Key, typename Combine>
+bool run_queries(const string& name, const pir_database& db, const vector<uint64_t>& targets, const vector<Key>* party_keys, thread_pool& pool, Combine combine) {
+    vector<vector<uint64_t>> answers[2];
+    double seconds = 0;
+    for(int b = 0;b < 2;b++) {
+        auto start = chrono::steady_clock::now();
+        answers[b] = answer_queries(db, span<const Key>(party_keys[b]), pool);
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    seconds /= 2;
+
+    bool correct = true;
+    for(size_t q = 0;q < targets.size();q++) {
+        const uint64_t* record = db.record(targets[q]);
+        for(size_t j = 0;j < db.record_words();j++) {
+            if(combine(answers[0][q][j], answers[1][q][j]) != record[j]) {
+                correct = false;
+            }
+        }
+    }
+    double bytes = (double)db.size() * db.record_words() * sizeof(uint64_t);
+    cout << name << ": " << targets.size() << " queries answered in " << seconds * 1000 << " ms per server ("
+         << bytes / seconds / 1e9 << " GB/s of database)" << endl;
+    cout << "Final Verdict for " << name << ": " << (correct ? "PASSED" : "FAILED") << endl << endl;
+    return correct;
+}
+
+/*
+A function that checks that keys whose domain does not cover the database are rejected instead of
+answering from leaves outside their domain: keys generated for half of the records, rounded down
+to a power of 2 so that the tree has one layer too few.
+*/
+bool check_short_keys(const pir_database& db, thread_pool& pool) {
+    if(db.size() < 2) {
+        return true;
+    }
+    uint64_t short_domain = bit_floor(db.size() - 1);
+    vector<dpf_key_type> xor_keys = generateDPF(short_domain, 0, 1);
+    int64_t one = 1;
+    vector<arithmetic_dpf_key_type> add_keys = generateArithmeticDPF(short_domain, 0, span<const int64_t>(&one, 1), RING_2_64);
+    try {
+        answer_queries(db, span<const dpf_key_type>(xor_keys), pool);
+        return false;
+    } catch(const invalid_argument&) {
+    }
+    try {
+        answer_queries(db, span<const arithmetic_dpf_key_type>(add_keys), pool);
+        return false;
+    } catch(const invalid_argument&) {
+    }
+    return true;
+}
+
+/* take command line arguments <num_records> <record_words> <num_queries> [threads] */
+int main(int argc, char* argv[]) {
+    if (argc != 4 && argc != 5) {
+        cerr << "Usage: pir.exe <num_records> <record_words> <num_queries> [threads]" << endl << "Record words: number of 64-bit words in a record" << endl << "Threads: number of threads used to answer the queries, all cores by default" << endl;
+        return 1;
+    }
+
+    uint64_t num_records = strtoull(argv[1], nullptr, 10);
+    size_t record_words = strtoull(argv[2], nullptr, 10);
+    int num_queries = atoi(argv[3]);
+    int threads = argc == 5 ? atoi(argv[4]) : thread::hardware_concurrency();
+    if(num_records == 0 || record_words == 0 || num_queries < 1 || threads < 1) {
+        cerr << "The number of records, record words, queries and threads should be positive" << endl;
+        return 1;
+    }
+    thread_pool pool(threads);
+
+    string path = write_random_database(num_records, record_words);
+    pir_database db(path, record_words);
+    // The mapping keeps the records readable after the file is removed
+    unlink(path.c_str());
+
+    vector<uint64_t> targets(num_queries);
+    for(auto& target : targets) {
+        target = random_index(num_records);
+    }
+
+    // XOR PIR with XOR DPF keys that select the target
+    vector<int64_t> ones(num_queries, 1);
+    vector<vector<dpf_key_type>> pairs = generateDPFBatch(num_records, targets, ones, pool);
+    vector<dpf_key_type> xor_keys[2];
+    for(auto& pair : pairs) {
+        xor_keys[0].push_back(pair[0]);
+        xor_keys[1].push_back(pair[1]);
+    }
+    bool xor_correct = run_queries("XOR PIR", db, targets, xor_keys, pool, [](uint64_t a, uint64_t b) { return a ^ b; });
+
+    // Additive PIR with arithmetic DPF keys that select the target
+    vector<arithmetic_dpf_key_type> add_keys[2];
+    int64_t one = 1;
+    for(uint64_t target : targets) {
+        vector<arithmetic_dpf_key_type> pair = generateArithmeticDPF(num_records, target, span<const int64_t>(&one, 1), RING_2_64);
+        add_keys[0].push_back(pair[0]);
+        add_keys[1].push_back(pair[1]);
+    }
+    bool add_correct = run_queries("Additive PIR", db, targets, add_keys, pool, [](uint64_t a, uint64_t b) { return a + b; });
+
+    bool short_keys_rejected = check_short_keys(db, pool);
+    cout << "Final Verdict for keys smaller than the database: " << (short_keys_rejected ? "PASSED" : "FAILED") << endl << endl;
+
+    // Batch PIR: all targets in one round with one small DPF per cuckoo bucket
+    cuckoo_params params = make_cuckoo_params(num_records, num_queries, random_uint());
+    cuckoo_database buckets(db, params);
+    bucket_layout client_layout(params);
+    batch_query query = generate_batch_query(client_layout, targets, pool);
+    vector<vector<uint64_t>> batch_answers[2];
+    double seconds = 0;
+    for(int b = 0;b < 2;b++) {
+        auto start = chrono::steady_clock::now();
+        batch_answers[b] = answer_batch(buckets, query.keys[b], pool);
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    seconds /= 2;
+    vector<vector<uint64_t>> records = reconstruct_batch(query, batch_answers[0], batch_answers[1]);
+    bool batch_correct = true;
+    for(int q = 0;q < num_queries;q++) {
+        if(!equal(records[q].begin(), records[q].end(), db.record(targets[q]))) {
+            batch_correct = false;
+        }
+    }
+    cout << "Batch PIR: " << num_queries << " queries answered in " << seconds * 1000 << " ms per server ("
+         << params.num_buckets << " buckets of at most " << client_layout.max_bucket_size() << " records)" << endl;
+    cout << "Final Verdict for Batch PIR: " << (batch_correct ? "PASSED" : "FAILED") << endl << endl;
+
+    return xor_correct && add_correct && short_keys_rejected && batch_correct ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRG_AESNI 1
+#endif
+
+/*
+Length-doubling PRG used to expand the seeds of the DPF trees of both assignments.
+
+It is fixed-key AES-128 in Matyas-Meyer-Oseas mode, H(x) = AES_k(x) ^ x, applied to the
+128-bit block (seed, counter). One call with counter 0 gives both children of a seed:
+the low 64 bits of H are the left child and the high 64 bits are the right child.
+Counters 1, 2, ... are used to expand a seed into more output words.
+
+Processors with AES-NI use the aesenc instructions and encrypt several blocks at once so
+that the rounds of independent blocks overlap. Other processors, and non-x86 targets where the
+AES-NI path is not compiled at all, use a portable table-free implementation of AES that
+produces the same outputs.
+*/
+
+namespace prg {
+
+// Fixed public key of the PRG (the first 16 bytes of the digits of pi)
+const uint8_t FIXED_KEY[16] = {0x24, 0x3f, 0x6a, 0x88, 0x85, 0xa3, 0x08, 0xd3, 0x13, 0x19, 0x8a, 0x2e, 0x03, 0x70, 0x73, 0x44};
+
+const uint8_t SBOX[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+inline uint8_t xtime(uint8_t x) {
+    return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+// The 11 round keys of AES-128 under FIXED_KEY, computed once
+struct round_keys {
+    alignas(16) uint8_t bytes[11][16];
+
+    round_keys() {
+        const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+        memcpy(bytes[0], FIXED_KEY, 16);
+        for (int round = 1; round <= 10; round++) {
+            const uint8_t* prev = bytes[round - 1];
+            uint8_t* key = bytes[round];
+            uint8_t temp[4] = {
+                (uint8_t)(SBOX[prev[13]] ^ rcon[round - 1]),
+                SBOX[prev[14]],
+                SBOX[prev[15]],
+                SBOX[prev[12]]
+            };
+            for (int i = 0; i < 16; i++) {
+                key[i] = prev[i] ^ (i < 4 ? temp[i] : key[i - 4]);
+            }
+        }
+    }
+};
+
+inline const round_keys& fixed_round_keys() {
+    static const round_keys keys;
+    return keys;
+}
+
+// Portable AES-128 encryption of one block in place
+inline void aes_encrypt_portable(uint8_t state[16]) {
+    const round_keys& keys = fixed_round_keys();
+    for (int i = 0; i < 16; i++) {
+        state[i] ^= keys.bytes[0][i];
+    }
+    for (int round = 1; round <= 10; round++) {
+        // SubBytes and ShiftRows, the state is stored column by column
+        uint8_t shifted[16];
+        for (int col = 0; col < 4; col++) {
+            for (int row = 0; row < 4; row++) {
+                shifted[4 * col + row] = SBOX[state[4 * ((col + row) % 4) + row]];
+            }
+        }
+        // MixColumns, skipped in the last round
+        if (round < 10) {
+            for (int col = 0; col < 4; col++) {
+                uint8_t* c = shifted + 4 * col;
+                uint8_t all = c[0] ^ c[1] ^ c[2] ^ c[3];
+                uint8_t first = c[0];
+                c[0] ^= all ^ xtime(c[0] ^ c[1]);
+                c[1] ^= all ^ xtime(c[1] ^ c[2]);
+                c[2] ^= all ^ xtime(c[2] ^ c[3]);
+                c[3] ^= all ^ xtime(c[3] ^ first);
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            state[i] = shifted[i] ^ keys.bytes[round][i];
+        }
+    }
+}
+
+// Matyas-Meyer-Oseas compression of the n blocks (low, high) = block(i), portable version
+template <typename Block>
+inline void mmo_blocks_portable(size_t n, int64_t* out, Block block_words) {
+    for (size_t i = 0; i < n; i++) {
+        auto [low, high] = block_words(i);
+        uint8_t block[16], state[16];
+        memcpy(block, &low, 8);
+        memcpy(block + 8, &high, 8);
+        memcpy(state, block, 16);
+        aes_encrypt_portable(state);
+        for (int j = 0; j < 16; j++) {
+            state[j] ^= block[j];
+        }
+        memcpy(&out[2 * i], state, 16);
+    }
+}
+
+#ifdef PRG_AESNI
+// Matyas-Meyer-Oseas compression of the n blocks (low, high) = block(i) with AES-NI.
+// Eight blocks are encrypted together so that their rounds are pipelined.
+template <typename Block>
+__attribute__((target("aes,sse4.1")))
+inline void mmo_blocks_aesni(size_t n, int64_t* out, Block block_words) {
+    const round_keys& keys = fixed_round_keys();
+    __m128i k[11];
+    for (int round = 0; round <= 10; round++) {
+        k[round] = _mm_load_si128((const __m128i*)keys.bytes[round]);
+    }
+
+    const size_t WIDTH = 8;
+    size_t i = 0;
+    for (; i + WIDTH <= n; i += WIDTH) {
+        __m128i block[WIDTH], state[WIDTH];
+        for (size_t j = 0; j < WIDTH; j++) {
+            auto [low, high] = block_words(i + j);
+            block[j] = _mm_set_epi64x(high, low);
+            state[j] = _mm_xor_si128(block[j], k[0]);
+        }
+        for (int round = 1; round < 10; round++) {
+            for (size_t j = 0; j < WIDTH; j++) {
+                state[j] = _mm_aesenc_si128(state[j], k[round]);
+            }
+        }
+        for (size_t j = 0; j < WIDTH; j++) {
+            state[j] = _mm_xor_si128(_mm_aesenclast_si128(state[j], k[10]), block[j]);
+            _mm_storeu_si128((__m128i*)&out[2 * (i + j)], state[j]);
+        }
+    }
+    for (; i < n; i++) {
+        auto [low, high] = block_words(i);
+        __m128i block = _mm_set_epi64x(high, low);
+        __m128i state = _mm_xor_si128(block, k[0]);
+        for (int round = 1; round < 10; round++) {
+            state = _mm_aesenc_si128(state, k[round]);
+        }
+        state = _mm_xor_si128(_mm_aesenclast_si128(state, k[10]), block);
+        _mm_storeu_si128((__m128i*)&out[2 * i], state);
+    }
+}
+
+inline bool has_aesni() {
+    static const bool supported = __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+    return supported;
+}
+#else
+template <typename Block>
+inline void mmo_blocks_aesni(size_t n, int64_t* out, Block block_words) {
+    mmo_blocks_portable(n, out, block_words);
+}
+
+inline bool has_aesni() {
+    return false;
+}
+#endif
+
+template <typename Block>
+inline void mmo_blocks(size_t n, int64_t* out, Block block_words) {
+    if (has_aesni()) {
+        mmo_blocks_aesni(n, out, block_words);
+    } else {
+        mmo_blocks_portable(n, out, block_words);
+    }
+}
+
+// out[2i] and out[2i+1] are the 128 output bits of H(seeds[i], counter). out must not overlap seeds.
+inline void mmo(const int64_t* seeds, int64_t counter, int64_t* out, size_t n) {
+    mmo_blocks(n, out, [&](size_t i) { return std::pair<int64_t, int64_t>(seeds[i], counter); });
+}
+
+// out[2i] and out[2i+1] are the 128 output bits of H(seed, first_counter + i), a stream of one seed
+inline void mmo_counters(int64_t seed, int64_t first_counter, int64_t* out, size_t n) {
+    mmo_blocks(n, out, [&](size_t i) { return std::pair<int64_t, int64_t>(seed, first_counter + (int64_t)i); });
+}
+
+} // namespace prg
+
+/*
+Given a 64bit random number(say 's') it generates two 64bit random numbers using 's' as the seed.
+*/
+inline void length_doubling_PRG(int64_t seed, int64_t& left, int64_t& right) {
+    int64_t out[2];
+    prg::mmo(&seed, 0, out, 1);
+    left = out[0];
+    right = out[1];
+}
+
+/*
+Expands n seeds at once: out[2i] and out[2i+1] are the left and right children of seeds[i].
+out must not overlap seeds.
+*/
+inline void length_doubling_PRG(const int64_t* seeds, int64_t* out, size_t n) {
+    prg::mmo(seeds, 0, out, n);
+}
+
+/*
+Expands a seed into `words` pseudorandom 64bit words (independent of its two children).
+*/
+inline void expand_seed(int64_t seed, int64_t* out, size_t words) {
+    prg::mmo_counters(seed, 1, out, words / 2);
+    if (words % 2 != 0) {
+        int64_t block[2];
+        prg::mmo_counters(seed, 1 + words / 2, block, 1);
+        out[words - 1] = block[0];
+    }
+}
+
+/*
+Expands n seeds into `words` words each, out[i * words + j] being word j of seed i (the same
+words as expand_seed). The blocks of several seeds are encrypted together. out must not overlap seeds.
+*/
+inline void expand_seeds(const int64_t* seeds, int64_t* out, size_t n, size_t words) {
+    const size_t CHUNK = 8;
+    for (size_t begin = 0; begin < n; begin += CHUNK) {
+        size_t count = std::min(CHUNK, n - begin);
+        for (size_t i = 0; i < words; i += 2) {
+            int64_t blocks[2 * CHUNK];
+            prg::mmo(seeds + begin, 1 + i / 2, blocks, count);
+            for (size_t j = 0; j < count; j++) {
+                out[(begin + j) * words + i] = blocks[2 * j];
+                if (i + 1 < words) {
+                    out[(begin + j) * words + i + 1] = blocks[2 * j + 1];
+                }
+            }
+        }
+    }
+}